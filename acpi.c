@@ -0,0 +1,107 @@
+// acpi.c - ACPI table lookup
+//
+// Multiboot v1 does not pass the RSDP, so it is found the BIOS way: in the
+// first KiB of the EBDA or in the 0xE0000-0xFFFFF ROM area. Tables are
+// reached through the identity map of the low 4 GiB.
+
+#include "kernel.h"
+
+// Where that identity map ends; 32-bit kernels put their stacks above it
+#if defined(__x86_64__)
+#define ACPI_MAP_LIMIT 0x100000000ULL
+#else
+#define ACPI_MAP_LIMIT DIRECT_MAP_LIMIT
+#endif
+
+struct acpi_rsdp {
+    char signature[8];
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt_address;
+    uint32_t length;            // Revision 2 and later
+    uint64_t xsdt_address;
+    uint8_t extended_checksum;
+    uint8_t reserved[3];
+} __attribute__((packed));
+
+static const struct acpi_rsdp* rsdp = 0;
+
+// Real-mode segment of the EBDA, from the BIOS data area. GCC takes the
+// first page to be unmapped, so the address is hidden from it.
+static uint16_t bios_ebda_segment(void) {
+    uintptr_t addr = 0x40E;
+
+    asm("" : "+r"(addr));
+    return *(volatile uint16_t*)addr;
+}
+
+static int acpi_checksum(const void* data, uint32_t length) {
+    const uint8_t* bytes = data;
+    uint8_t sum = 0;
+
+    for (uint32_t i = 0; i < length; i++) {
+        sum += bytes[i];
+    }
+    return sum == 0;
+}
+
+static int signature_is(const char* a, const char* b, int n) {
+    for (int i = 0; i < n; i++) {
+        if (a[i] != b[i]) return 0;
+    }
+    return 1;
+}
+
+static const struct acpi_rsdp* rsdp_scan(uintptr_t start, uintptr_t end) {
+    for (uintptr_t addr = start; addr + 20 <= end; addr += 16) {
+        const struct acpi_rsdp* r = (const struct acpi_rsdp*)addr;
+        if (signature_is(r->signature, "RSD PTR ", 8) && acpi_checksum(r, 20)) {
+            return r;
+        }
+    }
+    return 0;
+}
+
+// The length comes from firmware; it is checked before anything sums it
+static const struct acpi_sdt_header* acpi_table_at(phys_addr_t addr) {
+    if (!addr || addr + sizeof(struct acpi_sdt_header) > ACPI_MAP_LIMIT) return 0;
+
+    const struct acpi_sdt_header* h = (const struct acpi_sdt_header*)(uintptr_t)addr;
+    if (h->length < sizeof(*h) || addr + h->length > ACPI_MAP_LIMIT) return 0;
+    return acpi_checksum(h, h->length) ? h : 0;
+}
+
+// Returns the first table with the given signature, or 0
+__cold const struct acpi_sdt_header* acpi_find_table(const char* signature) {
+    if (!rsdp) {
+        uintptr_t ebda = (uintptr_t)bios_ebda_segment() << 4;
+        if (ebda) rsdp = rsdp_scan(ebda, ebda + 1024);
+        if (!rsdp) rsdp = rsdp_scan(0xE0000, 0x100000);
+        if (!rsdp) return 0;
+    }
+
+    const struct acpi_sdt_header* root = 0;
+    int entry_size = 4;
+    if (rsdp->revision >= 2 && rsdp->xsdt_address) {
+        root = acpi_table_at(rsdp->xsdt_address);
+        entry_size = 8;
+    }
+    if (!root) {
+        root = acpi_table_at(rsdp->rsdt_address);
+        entry_size = 4;
+    }
+    if (!root) return 0;
+
+    const uint8_t* entries = (const uint8_t*)root + sizeof(*root);
+    uint32_t count = (root->length - sizeof(*root)) / entry_size;
+    for (uint32_t i = 0; i < count; i++) {
+        phys_addr_t addr = entry_size == 8 ? *(const uint64_t*)(entries + i * 8)
+                                           : *(const uint32_t*)(entries + i * 4);
+        const struct acpi_sdt_header* h = acpi_table_at(addr);
+        if (h && signature_is(h->signature, signature, 4)) {
+            return h;
+        }
+    }
+    return 0;
+}
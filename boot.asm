@@ -15,7 +15,13 @@ section .multiboot
     dd MBOOT_CHECKSUM
 
 section .bss
-    align 16
+    ; paging_init() unmaps the guard page, so overflowing the boot stack
+    ; faults instead of running into the page tables or other .bss
+    align 4096
+    global boot_stack_guard
+    boot_stack_guard:
+        resb 4096
+    global stack_bottom
     stack_bottom:
         resb 16384      ; 16 KB stack
     stack_top:
@@ -57,22 +63,105 @@ gdt_flush:
 .flush:
     ret
 
-; Interrupt Service Routines (ISR) stubs
-global isr0
-global isr1
+; void switch_context(uintptr_t* old_sp, uintptr_t new_sp)
+; Saves the callee-saved registers on the current stack, stores its pointer
+; in *old_sp and resumes the thread whose stack new_sp points to
+global switch_context
+
+switch_context:
+    mov eax, [esp + 4]
+    mov edx, [esp + 8]
+    push ebp
+    push ebx
+    push esi
+    push edi
+    mov [eax], esp
+    mov esp, edx
+    pop edi
+    pop esi
+    pop ebx
+    pop ebp
+    ret
 
-isr0:
+; Interrupt Service Routines (ISR) stubs
+; Vectors 0-31 are CPU exceptions, 32-47 the remapped PIC IRQs.
+; The CPU pushes an error code for vectors 8, 10-14 and 17 only; the other
+; stubs push a dummy 0 so isr_handler always sees the same frame.
+%macro ISR_NOERRCODE 1
+isr%1:
     cli
     push byte 0
-    push byte 0
+    push byte %1
     jmp isr_common_stub
+%endmacro
 
-isr1:
+%macro ISR_ERRCODE 1
+isr%1:
     cli
-    push byte 0
-    push byte 1
+    push byte %1
     jmp isr_common_stub
+%endmacro
+
+ISR_NOERRCODE 0
+ISR_NOERRCODE 1
+ISR_NOERRCODE 2
+ISR_NOERRCODE 3
+ISR_NOERRCODE 4
+ISR_NOERRCODE 5
+ISR_NOERRCODE 6
+ISR_NOERRCODE 7
+ISR_ERRCODE   8
+ISR_NOERRCODE 9
+ISR_ERRCODE   10
+ISR_ERRCODE   11
+ISR_ERRCODE   12
+ISR_ERRCODE   13
+ISR_ERRCODE   14
+ISR_NOERRCODE 15
+ISR_NOERRCODE 16
+ISR_ERRCODE   17
+ISR_NOERRCODE 18
+ISR_NOERRCODE 19
+ISR_NOERRCODE 20
+ISR_NOERRCODE 21
+ISR_NOERRCODE 22
+ISR_NOERRCODE 23
+ISR_NOERRCODE 24
+ISR_NOERRCODE 25
+ISR_NOERRCODE 26
+ISR_NOERRCODE 27
+ISR_NOERRCODE 28
+ISR_NOERRCODE 29
+ISR_NOERRCODE 30
+ISR_NOERRCODE 31
+ISR_NOERRCODE 32
+ISR_NOERRCODE 33
+ISR_NOERRCODE 34
+ISR_NOERRCODE 35
+ISR_NOERRCODE 36
+ISR_NOERRCODE 37
+ISR_NOERRCODE 38
+ISR_NOERRCODE 39
+ISR_NOERRCODE 40
+ISR_NOERRCODE 41
+ISR_NOERRCODE 42
+ISR_NOERRCODE 43
+ISR_NOERRCODE 44
+ISR_NOERRCODE 45
+ISR_NOERRCODE 46
+ISR_NOERRCODE 47
 
+; Stub addresses, indexed by vector, for idt_install()
+section .rodata
+global isr_stub_table
+isr_stub_table:
+%assign i 0
+%rep 48
+    dd isr%+i
+%assign i i+1
+%endrep
+
+section .text
 isr_common_stub:
     pusha           ; Push all registers
     push ds
@@ -87,7 +176,9 @@ isr_common_stub:
     mov gs, ax
     
     extern isr_handler
+    push esp        ; struct registers* for isr_handler
     call isr_handler
+    add esp, 4
     
     pop gs
     pop fs
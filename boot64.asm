@@ -0,0 +1,331 @@
+; boot64.asm - Multiboot header and long-mode entry point (ARCH=x86_64)
+;
+; The multiboot loader enters in 32-bit protected mode. _start identity maps
+; the first 4 GiB with 2 MiB pages, turns on PAE and long mode and calls
+; kernel_main(magic, info) from 64-bit code, like boot.asm does in 32-bit.
+
+bits 32                         ; Entered in 32-bit mode
+
+section .multiboot
+    ; Multiboot header constants
+    MBOOT_MAGIC     equ 0x1BADB002
+    MBOOT_FLAGS     equ (1 << 0) | (1 << 1)  ; align modules, memory info
+    MBOOT_CHECKSUM  equ -(MBOOT_MAGIC + MBOOT_FLAGS)
+
+    ; Multiboot header
+    align 4
+    dd MBOOT_MAGIC
+    dd MBOOT_FLAGS
+    dd MBOOT_CHECKSUM
+
+section .bss
+    ; Boot page tables: PML4[0] -> PDPT, PDPT[0..3] -> four page directories
+    align 4096
+    boot_pml4:
+        resb 4096
+    boot_pdpt:
+        resb 4096
+    boot_pd:
+        resb 4096 * 4   ; 2048 x 2 MiB pages = 4 GiB
+
+    ; paging_init() unmaps the guard page, so overflowing the boot stack
+    ; faults instead of running into the page tables or other .bss
+    align 4096
+    global boot_stack_guard
+    boot_stack_guard:
+        resb 4096
+    global stack_bottom
+    stack_bottom:
+        resb 16384      ; 16 KB stack
+    stack_top:
+
+section .rodata
+    ; Just enough GDT to enter long mode; gdt_install() replaces it
+    align 8
+    boot_gdt:
+        dq 0
+        dq 0x00AF9A000000FFFF   ; 0x08: 64-bit code
+        dq 0x00CF92000000FFFF   ; 0x10: data
+    boot_gdt_end:
+
+    boot_gdt_ptr:
+        dw boot_gdt_end - boot_gdt - 1
+        dd boot_gdt
+
+    no_long_mode_msg:
+        db "SimpleOS: this CPU does not support 64-bit long mode", 0
+
+section .text
+    global _start
+    extern kernel_main
+
+_start:
+    ; Set up stack
+    mov esp, stack_top
+
+    ; Multiboot magic and info become kernel_main's first two arguments
+    mov edi, eax
+    mov esi, ebx
+
+    ; Long mode is CPUID 0x80000001 EDX bit 29
+    mov eax, 0x80000000
+    cpuid
+    cmp eax, 0x80000001
+    jb .no_long_mode
+    mov eax, 0x80000001
+    cpuid
+    test edx, 1 << 29
+    jz .no_long_mode
+
+    ; PML4[0] -> PDPT
+    mov eax, boot_pdpt
+    or eax, 0x03                ; Present, writable
+    mov [boot_pml4], eax
+
+    ; PDPT[0..3] -> page directories
+    xor ecx, ecx
+.map_pdpt:
+    mov eax, ecx
+    shl eax, 12
+    add eax, boot_pd
+    or eax, 0x03
+    mov [boot_pdpt + ecx * 8], eax
+    inc ecx
+    cmp ecx, 4
+    jne .map_pdpt
+
+    ; Identity map 0-4 GiB; the upper halves of the entries stay zero (.bss)
+    xor ecx, ecx
+.map_pd:
+    mov eax, ecx
+    shl eax, 21
+    or eax, 0x83                ; Present, writable, 2 MiB page
+    mov [boot_pd + ecx * 8], eax
+    inc ecx
+    cmp ecx, 2048
+    jne .map_pd
+
+    mov eax, boot_pml4
+    mov cr3, eax
+
+    mov eax, cr4
+    or eax, 1 << 5              ; PAE
+    mov cr4, eax
+
+    mov ecx, 0xC0000080         ; EFER
+    rdmsr
+    or eax, 1 << 8              ; Long mode enable
+    wrmsr
+
+    mov eax, cr0
+    or eax, 1 << 31             ; Paging (protected mode is already on)
+    mov cr0, eax
+
+    lgdt [boot_gdt_ptr]
+    jmp 0x08:long_mode_start
+
+.no_long_mode:
+    mov esi, no_long_mode_msg
+    mov edi, 0xB8000
+.print:
+    lodsb
+    test al, al
+    jz .halt
+    mov ah, 0x4F                ; White on red
+    stosw
+    jmp .print
+.halt:
+    cli
+    hlt
+    jmp .halt
+
+bits 64
+long_mode_start:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+
+    ; SSE2 is architectural in long mode; let it run (CR0.EM off, CR0.MP,
+    ; CR4.OSFXSR and CR4.OSXMMEXCPT on). The kernel itself is built without
+    ; SSE because the interrupt stubs do not save vector registers.
+    mov rax, cr0
+    and ax, 0xFFFB
+    or ax, 0x0002
+    mov cr0, rax
+    mov rax, cr4
+    or ax, 3 << 9
+    mov cr4, rax
+
+    ; Zero-extend the arguments saved in 32-bit mode
+    mov edi, edi
+    mov esi, esi
+
+    ; Call kernel main
+    call kernel_main
+
+    ; Halt if kernel returns
+    cli
+.hang:
+    hlt
+    jmp .hang
+
+; Global Descriptor Table (GDT) - reload after gdt_install() built it
+global gdt_flush
+extern gp
+
+gdt_flush:
+    lgdt [rel gp]   ; Load GDT
+    mov ax, 0x10    ; Data segment
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+    push 0x08       ; Far return to reload CS
+    lea rax, [rel .flush]
+    push rax
+    retfq
+.flush:
+    ret
+
+; void switch_context(uintptr_t* old_sp, uintptr_t new_sp)
+; Saves the callee-saved registers on the current stack, stores its pointer
+; in *old_sp and resumes the thread whose stack new_sp points to
+global switch_context
+
+switch_context:
+    push rbp
+    push rbx
+    push r12
+    push r13
+    push r14
+    push r15
+    mov [rdi], rsp
+    mov rsp, rsi
+    pop r15
+    pop r14
+    pop r13
+    pop r12
+    pop rbx
+    pop rbp
+    ret
+
+; Interrupt Service Routines (ISR) stubs
+; Same vectors and frame convention as boot.asm, with 64-bit slots.
+%macro ISR_NOERRCODE 1
+isr%1:
+    cli
+    push byte 0
+    push byte %1
+    jmp isr_common_stub
+%endmacro
+
+%macro ISR_ERRCODE 1
+isr%1:
+    cli
+    push byte %1
+    jmp isr_common_stub
+%endmacro
+
+ISR_NOERRCODE 0
+ISR_NOERRCODE 1
+ISR_NOERRCODE 2
+ISR_NOERRCODE 3
+ISR_NOERRCODE 4
+ISR_NOERRCODE 5
+ISR_NOERRCODE 6
+ISR_NOERRCODE 7
+ISR_ERRCODE   8
+ISR_NOERRCODE 9
+ISR_ERRCODE   10
+ISR_ERRCODE   11
+ISR_ERRCODE   12
+ISR_ERRCODE   13
+ISR_ERRCODE   14
+ISR_NOERRCODE 15
+ISR_NOERRCODE 16
+ISR_ERRCODE   17
+ISR_NOERRCODE 18
+ISR_NOERRCODE 19
+ISR_NOERRCODE 20
+ISR_NOERRCODE 21
+ISR_NOERRCODE 22
+ISR_NOERRCODE 23
+ISR_NOERRCODE 24
+ISR_NOERRCODE 25
+ISR_NOERRCODE 26
+ISR_NOERRCODE 27
+ISR_NOERRCODE 28
+ISR_NOERRCODE 29
+ISR_NOERRCODE 30
+ISR_NOERRCODE 31
+ISR_NOERRCODE 32
+ISR_NOERRCODE 33
+ISR_NOERRCODE 34
+ISR_NOERRCODE 35
+ISR_NOERRCODE 36
+ISR_NOERRCODE 37
+ISR_NOERRCODE 38
+ISR_NOERRCODE 39
+ISR_NOERRCODE 40
+ISR_NOERRCODE 41
+ISR_NOERRCODE 42
+ISR_NOERRCODE 43
+ISR_NOERRCODE 44
+ISR_NOERRCODE 45
+ISR_NOERRCODE 46
+ISR_NOERRCODE 47
+
+; Stub addresses, indexed by vector, for idt_install()
+section .rodata
+global isr_stub_table
+isr_stub_table:
+%assign i 0
+%rep 48
+    dq isr%+i
+%assign i i+1
+%endrep
+
+section .text
+isr_common_stub:
+    push rax        ; Push all general-purpose registers
+    push rbx
+    push rcx
+    push rdx
+    push rbp
+    push rsi
+    push rdi
+    push r8
+    push r9
+    push r10
+    push r11
+    push r12
+    push r13
+    push r14
+    push r15
+    
+    extern isr_handler
+    mov rdi, rsp    ; struct registers* for isr_handler
+    cld
+    call isr_handler
+    
+    pop r15
+    pop r14
+    pop r13
+    pop r12
+    pop r11
+    pop r10
+    pop r9
+    pop r8
+    pop rdi
+    pop rsi
+    pop rbp
+    pop rdx
+    pop rcx
+    pop rbx
+    pop rax
+    add rsp, 16     ; Clean up pushed error code and ISR number
+    iretq           ; Return from interrupt
@@ -0,0 +1,91 @@
+// chan.c - Shared-memory message channels
+//
+// The ring itself and the fast paths are inline in kernel.h; this file
+// sets channels up and handles the slow paths. A side that finds the ring
+// full or empty sets its waiting flag, fences, and sleeps on a futex on
+// the other side's index for as long as that index has not moved. The
+// other side checks the flag after every publish or consume, so in steady
+// state neither enters the kernel. Since futexes are keyed by physical
+// address, nothing here needs to know where each side maps the ring.
+//
+// The ring lives in two frames of its own, ready to be mapped into the
+// address spaces of both ends; for now both ends are kernel threads that
+// reach it through the direct map.
+
+#include "kernel.h"
+
+struct chan* chan_create(void) {
+    struct chan* ch = kmalloc(sizeof(*ch));
+    phys_addr_t ring, slots;
+
+    if (!ch) return 0;
+    ring = pmm_alloc_frame();
+    slots = ring ? pmm_alloc_frame() : 0;
+    if (!slots) {
+        if (ring) pmm_free_frame(ring);
+        kfree(ch);
+        return 0;
+    }
+    ch->ring = phys_to_virt(ring);
+    ch->slots = phys_to_virt(slots);
+    ch->ring->head = 0;
+    ch->ring->reader_waiting = 0;
+    ch->ring->tail = 0;
+    ch->ring->writer_waiting = 0;
+    ch->sleeps = 0;
+    ch->wakeups = 0;
+    return ch;
+}
+
+// Neither side may still be using the channel
+void chan_destroy(struct chan* ch) {
+    pmm_free_frame(virt_to_phys(ch->slots));
+    pmm_free_frame(virt_to_phys(ch->ring));
+    kfree(ch);
+}
+
+void chan_wake_reader(struct chan* ch) {
+    ch->wakeups++;
+    futex_wake(&ch->ring->head, 1);
+}
+
+void chan_wake_writer(struct chan* ch) {
+    ch->wakeups++;
+    futex_wake(&ch->ring->tail, 1);
+}
+
+// Thread context. Sleeps until a slot is free.
+struct chan_slot* chan_reserve_wait(struct chan* ch) {
+    struct chan_ring* r = ch->ring;
+    struct chan_slot* slot;
+
+    while (!(slot = chan_reserve(ch))) {
+        uint32_t tail = r->tail;
+
+        r->writer_waiting = 1;
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (r->head - r->tail == CHAN_SLOTS && futex_wait(&r->tail, tail) == 0) {
+            ch->sleeps++;
+        }
+        r->writer_waiting = 0;
+    }
+    return slot;
+}
+
+// Thread context. Sleeps until a message arrives.
+struct chan_slot* chan_peek_wait(struct chan* ch) {
+    struct chan_ring* r = ch->ring;
+    struct chan_slot* slot;
+
+    while (!(slot = chan_peek(ch))) {
+        uint32_t head = r->head;
+
+        r->reader_waiting = 1;
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (r->head == r->tail && futex_wait(&r->head, head) == 0) {
+            ch->sleeps++;
+        }
+        r->reader_waiting = 0;
+    }
+    return slot;
+}
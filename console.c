@@ -0,0 +1,339 @@
+// console.c - VGA text terminal, COM1 serial port and PS/2 keyboard
+
+#include "kernel.h"
+
+// VGA text mode buffer
+#define VGA_MEMORY 0xB8000
+
+// Keyboard ports
+#define KEYBOARD_DATA_PORT 0x60
+#define KEYBOARD_STATUS_PORT 0x64
+
+// Serial port (COM1)
+#define COM1_PORT 0x3F8
+
+#define INPUT_BUFFER_SIZE 256
+
+static uint16_t* vga_buffer = (uint16_t*)VGA_MEMORY;
+static size_t terminal_row = 0;
+static size_t terminal_col = 0;
+static uint8_t terminal_color = 0;
+int serial_present = 0;
+int serial_input = 1;
+enum console_mode console_mode = CONSOLE_BOTH;
+
+static char input_buffer[INPUT_BUFFER_SIZE];
+static volatile uint32_t input_head = 0;
+static volatile uint32_t input_tail = 0;
+static struct wait_queue input_wait;
+
+// Serial functions
+__cold void serial_initialize(void) {
+    outb(COM1_PORT + 1, 0x00);    // Disable UART interrupts
+    outb(COM1_PORT + 3, 0x80);    // Enable DLAB to set the divisor
+    outb(COM1_PORT + 0, 0x01);    // Divisor 1 = 115200 baud
+    outb(COM1_PORT + 1, 0x00);
+    outb(COM1_PORT + 3, 0x03);    // 8 bits, no parity, one stop bit
+    outb(COM1_PORT + 2, 0xC1);    // Enable FIFOs, 14-byte threshold
+    outb(COM1_PORT + 4, 0x0B);    // DTR, RTS, OUT2
+
+    // Probe via the scratch register; a loopback test would eat
+    // input that is already queued for the shell
+    outb(COM1_PORT + 7, 0xAE);
+    if (inb(COM1_PORT + 7) != 0xAE) {
+        return;                   // No UART behind COM1
+    }
+
+    serial_present = 1;
+}
+
+KPARAM_BOOL(serial_input, serial_input, 0, "Accept shell input on COM1");
+
+int serial_received(void) {
+    return inb(COM1_PORT + 5) & 0x01;
+}
+
+__hot void serial_putchar(char c) {
+    if (c == '\n') {
+        serial_putchar('\r');
+    }
+    while (!(inb(COM1_PORT + 5) & 0x20)) {
+        // Wait for the transmit holding register to drain
+    }
+    outb(COM1_PORT, (uint8_t)c);
+}
+
+void serial_writestring(const char* str) {
+    while (*str) {
+        serial_putchar(*str++);
+    }
+}
+
+// Helper functions
+static inline uint16_t make_vgaentry(char c, uint8_t color) {
+    return (uint16_t)c | (uint16_t)color << 8;
+}
+
+void terminal_initialize(void) {
+    terminal_row = 0;
+    terminal_col = 0;
+    terminal_color = make_color(LIGHT_GREEN, BLACK);
+    
+    for (size_t y = 0; y < VGA_HEIGHT; y++) {
+        for (size_t x = 0; x < VGA_WIDTH; x++) {
+            const size_t index = y * VGA_WIDTH + x;
+            vga_buffer[index] = make_vgaentry(' ', terminal_color);
+        }
+    }
+}
+
+void terminal_setcolor(uint8_t color) {
+    terminal_color = color;
+}
+
+void terminal_setpos(size_t row, size_t col) {
+    terminal_row = row;
+    terminal_col = col;
+}
+
+static const char* const console_mode_names[] = { "vga", "serial", "both" };
+KPARAM_ENUM(console, console_mode, console_mode_names, 0, "Console output device");
+
+static __hot void console_putchar(char c) {
+    if (serial_present && console_mode != CONSOLE_VGA) {
+        serial_putchar(c);
+    }
+    if (console_mode == CONSOLE_SERIAL) {
+        return;
+    }
+
+    if (c == '\n') {
+        terminal_col = 0;
+        if (++terminal_row == VGA_HEIGHT) {
+            // Scroll up
+            for (size_t y = 0; y < VGA_HEIGHT - 1; y++) {
+                for (size_t x = 0; x < VGA_WIDTH; x++) {
+                    vga_buffer[y * VGA_WIDTH + x] = vga_buffer[(y + 1) * VGA_WIDTH + x];
+                }
+            }
+            // Clear last line
+            for (size_t x = 0; x < VGA_WIDTH; x++) {
+                vga_buffer[(VGA_HEIGHT - 1) * VGA_WIDTH + x] = make_vgaentry(' ', terminal_color);
+            }
+            terminal_row = VGA_HEIGHT - 1;
+        }
+        return;
+    }
+    
+    const size_t index = terminal_row * VGA_WIDTH + terminal_col;
+    vga_buffer[index] = make_vgaentry(c, terminal_color);
+    
+    if (++terminal_col == VGA_WIDTH) {
+        terminal_col = 0;
+        if (++terminal_row == VGA_HEIGHT) {
+            terminal_row = 0;
+        }
+    }
+}
+
+// Output of a thread with a sink goes there; interrupt handlers still
+// reach the console
+static inline struct sink* terminal_sink(void) {
+    struct sink* out = current_thread->out;
+    return (out && !in_interrupt()) ? out : 0;
+}
+
+__hot void terminal_putchar(char c) {
+    struct sink* out = terminal_sink();
+
+    if (out) sink_write(out, &c, 1);
+    else console_putchar(c);
+}
+
+// Erase the character left of the cursor on every console device
+void terminal_backspace(void) {
+    if (serial_present && console_mode != CONSOLE_VGA) {
+        serial_writestring("\b \b");
+    }
+    if (console_mode != CONSOLE_SERIAL && terminal_col > 0) {
+        terminal_col--;
+        size_t index = terminal_row * VGA_WIDTH + terminal_col;
+        vga_buffer[index] = make_vgaentry(' ', terminal_color);
+    }
+}
+
+void terminal_writestring(const char* str) {
+    struct sink* out = terminal_sink();
+
+    if (out) {
+        sink_write(out, str, str_len(str));
+        return;
+    }
+    for (size_t i = 0; str[i] != '\0'; i++) {
+        console_putchar(str[i]);
+    }
+}
+
+// /dev/console, /dev/serial and /dev/null are devices; any other path is
+// a ramfs file, created if missing and emptied unless appending
+int sink_open(struct sink* sink, const char* path, int append) {
+    struct ramfs_file* f;
+
+    sink->target = 0;
+    if (str_cmp(path, "/dev/console") == 0) {
+        sink->type = SINK_CONSOLE;
+    } else if (str_cmp(path, "/dev/serial") == 0) {
+        sink->type = SINK_SERIAL;
+    } else if (str_cmp(path, "/dev/null") == 0) {
+        sink->type = SINK_NULL;
+    } else {
+        f = ramfs_create(path);
+        if (!f) return 0;
+        if (!append) ramfs_truncate(f);
+        sink->type = SINK_FILE;
+        sink->target = f;
+    }
+    return 1;
+}
+
+void sink_write(struct sink* sink, const char* data, uint32_t len) {
+    switch (sink->type) {
+    case SINK_CONSOLE:
+        for (uint32_t i = 0; i < len; i++) console_putchar(data[i]);
+        break;
+    case SINK_SERIAL:
+        for (uint32_t i = 0; serial_present && i < len; i++) serial_putchar(data[i]);
+        break;
+    case SINK_NULL:
+        break;
+    case SINK_PIPE:
+        pipe_write(sink->target, data, len);
+        break;
+    case SINK_FILE:
+        ramfs_write(sink->target, data, len);
+        break;
+    }
+}
+
+void terminal_writehex(uintptr_t value) {
+    char hex[] = "0123456789ABCDEF";
+    terminal_writestring("0x");
+    for (int i = sizeof(value) * 8 - 4; i >= 0; i -= 4) {
+        terminal_putchar(hex[(value >> i) & 0xF]);
+    }
+}
+
+void terminal_writedec(uint32_t value) {
+    if (value == 0) {
+        terminal_putchar('0');
+        return;
+    }
+    
+    char buffer[12];
+    int i = 0;
+    while (value > 0) {
+        buffer[i++] = '0' + (value % 10);
+        value /= 10;
+    }
+    
+    while (i > 0) {
+        terminal_putchar(buffer[--i]);
+    }
+}
+
+// Keyboard functions
+char keyboard_scancode_to_ascii(uint8_t scancode) {
+    static const char scancode_map[] = {
+        0, 0, '1', '2', '3', '4', '5', '6', '7', '8', '9', '0', '-', '=', '\b',
+        '\t', 'q', 'w', 'e', 'r', 't', 'y', 'u', 'i', 'o', 'p', '[', ']', '\n',
+        0, 'a', 's', 'd', 'f', 'g', 'h', 'j', 'k', 'l', ';', '\'', '`',
+        0, '\\', 'z', 'x', 'c', 'v', 'b', 'n', 'm', ',', '.', '/', 0,
+        '*', 0, ' '
+    };
+    
+    if (scancode < sizeof(scancode_map)) {
+        return scancode_map[scancode];
+    }
+    return 0;
+}
+
+// Characters from the keyboard and COM1 interrupts, oldest first
+static void input_push(char c) {
+    if (input_tail - input_head < INPUT_BUFFER_SIZE) {
+        input_buffer[input_tail++ % INPUT_BUFFER_SIZE] = c;
+        wake_up(&input_wait);
+    }
+}
+
+static void keyboard_irq(struct registers* regs) {
+    (void)regs;
+    while (inb(KEYBOARD_STATUS_PORT) & 1) {
+        uint8_t scancode = inb(KEYBOARD_DATA_PORT);
+
+        // Only handle key press (not release)
+        if (!(scancode & 0x80)) {
+            char c = keyboard_scancode_to_ascii(scancode);
+            if (c) input_push(c);
+        }
+    }
+}
+
+// Serial input doubles as a keyboard for headless runs. The FIFO is
+// drained even when serial_input is off, or the UART would keep asking.
+static void serial_irq(struct registers* regs) {
+    (void)regs;
+    while (serial_received()) {
+        char c = (char)inb(COM1_PORT);
+        if (!serial_input) continue;
+        if (c == '\r') c = '\n';
+        if (c == 0x7F) c = '\b';
+        input_push(c);
+    }
+}
+
+__cold void keyboard_install(void) {
+    irq_install_handler(1, keyboard_irq);
+    if (serial_present) {
+        irq_install_handler(4, serial_irq);
+        outb(COM1_PORT + 1, 0x01);    // Interrupt on received data
+    }
+}
+
+// Sleeps until a key arrives
+char keyboard_read_char() {
+    char c;
+
+    wait_event(&input_wait, input_head != input_tail);
+    c = input_buffer[input_head++ % INPUT_BUFFER_SIZE];
+    return c;
+}
+
+// Drawing functions
+void draw_box(int x, int y, int width, int height, uint8_t color) {
+    for (int row = y; row < y + height && row < VGA_HEIGHT; row++) {
+        for (int col = x; col < x + width && col < VGA_WIDTH; col++) {
+            if (row >= 0 && col >= 0) {
+                size_t index = row * VGA_WIDTH + col;
+                vga_buffer[index] = make_vgaentry(' ', color);
+            }
+        }
+    }
+}
+
+void draw_progress_bar(int percentage) {
+    int width = 50;
+    int filled = (width * percentage) / 100;
+    
+    terminal_writestring("[");
+    for (int i = 0; i < width; i++) {
+        if (i < filled) {
+            terminal_putchar('=');
+        } else {
+            terminal_putchar(' ');
+        }
+    }
+    terminal_writestring("] ");
+    terminal_writedec(percentage);
+    terminal_writestring("%\n");
+}
+
@@ -0,0 +1,116 @@
+// futex.c - Sleeping on a word in memory
+//
+// futex_wait() sleeps only if the word still holds the value the caller
+// last saw, checked with interrupts off and the waiter queued in the same
+// step, so a futex_wake() after the caller changed the word is not lost.
+// Waiters hang off a hashed table of buckets keyed by the word's physical
+// address; the page walk for the key is only paid on these slow paths.
+//
+// fmutex is the three-state mutex from Drepper's "Futexes Are Tricky":
+// unlocking calls futex_wake() only when the state says someone may be
+// asleep. fcond keeps a waiter count so that signalling with nobody
+// waiting does not call in here either.
+
+#include "kernel.h"
+
+#define FUTEX_HASH_BITS 6
+#define FUTEX_HASH_SIZE (1u << FUTEX_HASH_BITS)
+
+struct futex_waiter {
+    struct futex_waiter* next;
+    struct thread* thread;
+    phys_addr_t key;
+    int woken;
+};
+
+struct futex_bucket {
+    struct futex_waiter* head;          // FIFO; keys may be mixed
+};
+
+static struct futex_bucket futex_table[FUTEX_HASH_SIZE];
+uint32_t futex_calls = 0;
+
+static struct futex_bucket* futex_bucket(phys_addr_t key) {
+    uint32_t hash = (uint32_t)(key >> 2) ^ (uint32_t)(key >> 32);
+    return &futex_table[(hash * 0x9E3779B1u) >> (32 - FUTEX_HASH_BITS)];
+}
+
+// Thread context. Returns 0 after sleeping (the caller rechecks: a wakeup
+// is only a hint), or -1 at once if *addr != val or addr is not mapped.
+int futex_wait(volatile uint32_t* addr, uint32_t val) {
+    phys_addr_t key = paging_lookup((uintptr_t)addr);
+    struct futex_waiter self = { 0, current_thread, key, 0 };
+
+    futex_calls++;
+    if (!key) return -1;
+
+    unsigned long flags = irq_save();
+    struct futex_bucket* b = futex_bucket(key);
+    struct futex_waiter** p = &b->head;
+
+    if (*addr != val) {
+        irq_restore(flags);
+        return -1;
+    }
+    while (*p) p = &(*p)->next;
+    *p = &self;
+    thread_block();
+
+    // Woken some other way: take ourselves off the bucket
+    if (!self.woken) {
+        for (p = &b->head; *p; p = &(*p)->next) {
+            if (*p != &self) continue;
+            *p = self.next;
+            break;
+        }
+    }
+    irq_restore(flags);
+    return 0;
+}
+
+// Wakes up to count waiters on addr, oldest first; returns how many
+uint32_t futex_wake(volatile uint32_t* addr, uint32_t count) {
+    phys_addr_t key = paging_lookup((uintptr_t)addr);
+    uint32_t woken = 0;
+
+    futex_calls++;
+    if (!key) return 0;
+
+    unsigned long flags = irq_save();
+    struct futex_waiter** p = &futex_bucket(key)->head;
+
+    while (*p && woken < count) {
+        struct futex_waiter* w = *p;
+        if (w->key != key) {
+            p = &w->next;
+            continue;
+        }
+        *p = w->next;
+        w->woken = 1;
+        thread_wake(w->thread);
+        woken++;
+    }
+    irq_restore(flags);
+    return woken;
+}
+
+// Contended: mark the lock as having sleepers, then sleep until it is
+// handed back free. Leaves state 2, so unlock wakes the next sleeper.
+void fmutex_lock_slow(struct fmutex* m) {
+    while (__atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE)) {
+        futex_wait(&m->state, 2);
+    }
+}
+
+// Call with m held; it is held again on return. Wakeups may be spurious.
+void fcond_wait(struct fcond* cv, struct fmutex* m) {
+    __atomic_fetch_add(&cv->waiters, 1, __ATOMIC_SEQ_CST);
+    uint32_t seq = __atomic_load_n(&cv->seq, __ATOMIC_SEQ_CST);
+
+    fmutex_unlock(m);
+    futex_wait(&cv->seq, seq);
+    __atomic_fetch_sub(&cv->waiters, 1, __ATOMIC_SEQ_CST);
+
+    // Others may be asleep on m too, so take it as contended
+    fmutex_lock_slow(m);
+}
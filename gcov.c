@@ -0,0 +1,168 @@
+// gcov.c - Export -fprofile-arcs counters over COM1 for profile-guided builds
+//
+// Only linked into PROFILE=instrumented kernels. GCC's -fprofile-info-section
+// leaves a pointer to every object's gcov_info in the .gcov_info section;
+// gcov_dump() turns each one into the contents of its .gcda file and prints
+// it as hex between GCOV-FILE/GCOV-END lines for tools/gcov-extract.sh.
+
+#include "kernel.h"
+
+// Layout and tags of GCC 12's gcov data (libgcc/libgcov.h, gcc/gcov-io.h)
+#define GCOV_COUNTERS 8
+#define GCOV_COUNTER_ARCS 0
+#define GCOV_DATA_MAGIC 0x67636461          // "gcda"
+#define GCOV_TAG_FUNCTION 0x01000000
+#define GCOV_TAG_FUNCTION_LENGTH 12
+#define GCOV_TAG_COUNTER_BASE 0x01A10000
+#define GCOV_TAG_OBJECT_SUMMARY 0xA1000000
+#define GCOV_TAG_SUMMARY_LENGTH 8
+
+typedef int64_t gcov_type;
+
+struct gcov_info;
+
+struct gcov_ctr_info {
+    uint32_t num;
+    gcov_type* values;
+};
+
+struct gcov_fn_info {
+    const struct gcov_info* key;
+    uint32_t ident;
+    uint32_t lineno_checksum;
+    uint32_t cfg_checksum;
+    struct gcov_ctr_info ctrs[];        // One per counter kind with a merge function
+};
+
+struct gcov_info {
+    uint32_t version;
+    struct gcov_info* next;
+    uint32_t stamp;
+    uint32_t checksum;
+    const char* filename;
+    void (*merge[GCOV_COUNTERS])(gcov_type*, uint32_t);
+    uint32_t n_functions;
+    const struct gcov_fn_info* const* functions;
+};
+
+extern const struct gcov_info* const __gcov_info_start[];
+extern const struct gcov_info* const __gcov_info_end[];
+
+static int gcov_column = 0;
+
+// Instrumented objects reference this to mark arc counters as present.
+// Runs are merged on the host, so it is never called.
+void __gcov_merge_add(gcov_type* counters, uint32_t n) {
+    (void)counters;
+    (void)n;
+}
+
+static void gcov_emit_byte(uint8_t byte) {
+    static const char hex[] = "0123456789abcdef";
+
+    serial_putchar(hex[byte >> 4]);
+    serial_putchar(hex[byte & 0xF]);
+    if (++gcov_column == 32) {
+        serial_putchar('\n');
+        gcov_column = 0;
+    }
+}
+
+// .gcda files are streams of 32-bit words in the target's byte order
+static void gcov_emit_u32(uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        gcov_emit_byte((value >> (i * 8)) & 0xFF);
+    }
+}
+
+static void gcov_emit_counter(gcov_type value) {
+    gcov_emit_u32((uint32_t)value);
+    gcov_emit_u32((uint32_t)((uint64_t)value >> 32));
+}
+
+// The object summary carries the largest arc count of the whole run, which
+// -fprofile-use scales its hot/cold thresholds by
+static gcov_type gcov_sum_max(void) {
+    gcov_type max = 0;
+
+    for (const struct gcov_info* const* info = __gcov_info_start; info < __gcov_info_end; info++) {
+        if (!(*info)->merge[GCOV_COUNTER_ARCS]) continue;
+        for (uint32_t f = 0; f < (*info)->n_functions; f++) {
+            const struct gcov_fn_info* fn = (*info)->functions[f];
+            if (!fn || fn->key != *info) continue;
+            for (uint32_t i = 0; i < fn->ctrs[0].num; i++) {
+                if (fn->ctrs[0].values[i] > max) {
+                    max = fn->ctrs[0].values[i];
+                }
+            }
+        }
+    }
+    return max;
+}
+
+static void gcov_emit_info(const struct gcov_info* info, gcov_type sum_max) {
+    gcov_emit_u32(GCOV_DATA_MAGIC);
+    gcov_emit_u32(info->version);
+    gcov_emit_u32(info->stamp);
+    gcov_emit_u32(info->checksum);
+
+    gcov_emit_u32(GCOV_TAG_OBJECT_SUMMARY);
+    gcov_emit_u32(GCOV_TAG_SUMMARY_LENGTH);
+    gcov_emit_u32(1);                       // runs
+    gcov_emit_u32((uint32_t)sum_max);
+
+    for (uint32_t f = 0; f < info->n_functions; f++) {
+        const struct gcov_fn_info* fn = info->functions[f];
+
+        // COMDAT copies owned by another object get an empty record
+        gcov_emit_u32(GCOV_TAG_FUNCTION);
+        if (!fn || fn->key != info) {
+            gcov_emit_u32(0);
+            continue;
+        }
+        gcov_emit_u32(GCOV_TAG_FUNCTION_LENGTH);
+        gcov_emit_u32(fn->ident);
+        gcov_emit_u32(fn->lineno_checksum);
+        gcov_emit_u32(fn->cfg_checksum);
+
+        const struct gcov_ctr_info* ctr = fn->ctrs;
+        for (uint32_t kind = 0; kind < GCOV_COUNTERS; kind++) {
+            if (!info->merge[kind]) continue;
+            gcov_emit_u32(GCOV_TAG_COUNTER_BASE + (kind << 17));
+            gcov_emit_u32(ctr->num * 8);
+            for (uint32_t i = 0; i < ctr->num; i++) {
+                gcov_emit_counter(ctr->values[i]);
+            }
+            ctr++;
+        }
+    }
+}
+
+void gcov_dump() {
+    gcov_type sum_max = gcov_sum_max();
+    uint32_t files = 0;
+
+    if (!serial_present) {
+        terminal_writestring("gcov: COM1 is required to export profiles\n");
+        return;
+    }
+
+    for (const struct gcov_info* const* info = __gcov_info_start; info < __gcov_info_end; info++) {
+        serial_writestring("GCOV-FILE ");
+        serial_writestring((*info)->filename);
+        serial_putchar('\n');
+
+        gcov_column = 0;
+        gcov_emit_info(*info, sum_max);
+        if (gcov_column) {
+            serial_putchar('\n');
+        }
+
+        serial_writestring("GCOV-END\n");
+        files++;
+    }
+
+    terminal_writestring("gcov: exported ");
+    terminal_writedec(files);
+    terminal_writestring(" profiles\n");
+}
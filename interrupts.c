@@ -0,0 +1,403 @@
+// interrupts.c - GDT, IDT, PIC and PIT setup and interrupt dispatch
+
+#include "kernel.h"
+
+// 8259 PIC ports; IRQs 0-15 are remapped to vectors 32-47
+#define PIC1_COMMAND 0x20
+#define PIC1_DATA 0x21
+#define PIC2_COMMAND 0xA0
+#define PIC2_DATA 0xA1
+#define PIC_EOI 0x20
+#define IRQ_BASE 32
+
+// 8253/8254 PIT
+#define PIT_CHANNEL0 0x40
+#define PIT_COMMAND 0x43
+#define PIT_FREQUENCY 1193182
+
+uint32_t timer_ticks = 0;
+uint32_t timer_hz = 100;
+
+// GDT structures
+struct gdt_entry {
+    uint16_t limit_low;
+    uint16_t base_low;
+    uint8_t base_middle;
+    uint8_t access;
+    uint8_t granularity;
+    uint8_t base_high;
+} __attribute__((packed));
+
+struct gdt_ptr {
+    uint16_t limit;
+    uintptr_t base;
+} __attribute__((packed));
+
+// Task state segments. The kernel TSS is the one TR points at. On i386 a
+// task gate sends double faults to a second TSS with its own stack and
+// state, so even a fault on an overflowed stack gets a clean handler; on
+// x86-64 the same job falls to IST1 in the kernel TSS.
+#ifdef __x86_64__
+struct tss {
+    uint32_t reserved0;
+    uint64_t rsp[3];
+    uint64_t reserved1;
+    uint64_t ist[7];
+    uint64_t reserved2;
+    uint16_t reserved3;
+    uint16_t iomap_base;
+} __attribute__((packed));
+#else
+struct tss {
+    uint16_t link, reserved0;
+    uint32_t esp0;
+    uint16_t ss0, reserved1;
+    uint32_t esp1;
+    uint16_t ss1, reserved2;
+    uint32_t esp2;
+    uint16_t ss2, reserved3;
+    uint32_t cr3, eip, eflags, eax, ecx, edx, ebx, esp, ebp, esi, edi;
+    uint16_t es, reserved4, cs, reserved5, ss, reserved6;
+    uint16_t ds, reserved7, fs, reserved8, gs, reserved9;
+    uint16_t ldt, reserved10, trap, iomap_base;
+} __attribute__((packed));
+#endif
+
+// GDT layout: 0x08 kernel code, 0x10 kernel data, 0x28 kernel TSS (two
+// slots on x86-64), 0x30 double-fault TSS (i386)
+#define GDT_ENTRIES 7
+#define GDT_TSS 5
+#define GDT_DF_TSS 6
+#define TSS_SELECTOR (GDT_TSS * 8)
+#define DF_TSS_SELECTOR (GDT_DF_TSS * 8)
+#define DOUBLE_FAULT_STACK_SIZE 8192
+
+struct gdt_entry gdt[GDT_ENTRIES];
+struct gdt_ptr gp;
+struct tss kernel_tss;
+static uint8_t double_fault_stack[DOUBLE_FAULT_STACK_SIZE] __attribute__((aligned(16)));
+#ifndef __x86_64__
+static struct tss double_fault_tss;
+static void double_fault_task(void);
+#endif
+
+extern void gdt_flush();
+
+void gdt_set_gate(int num, uint32_t base, uint32_t limit, uint8_t access, uint8_t gran) {
+    gdt[num].base_low = (base & 0xFFFF);
+    gdt[num].base_middle = (base >> 16) & 0xFF;
+    gdt[num].base_high = (base >> 24) & 0xFF;
+    gdt[num].limit_low = (limit & 0xFFFF);
+    gdt[num].granularity = ((limit >> 16) & 0x0F) | (gran & 0xF0);
+    gdt[num].access = access;
+}
+
+__cold void gdt_install() {
+    uintptr_t stack_top = (uintptr_t)double_fault_stack + DOUBLE_FAULT_STACK_SIZE;
+
+    gp.limit = (sizeof(struct gdt_entry) * GDT_ENTRIES) - 1;
+    gp.base = (uintptr_t)&gdt;
+    
+    gdt_set_gate(0, 0, 0, 0, 0);
+#ifdef __x86_64__
+    gdt_set_gate(1, 0, 0xFFFFFFFF, 0x9A, 0xAF);    // L bit: 64-bit code
+#else
+    gdt_set_gate(1, 0, 0xFFFFFFFF, 0x9A, 0xCF);
+#endif
+    gdt_set_gate(2, 0, 0xFFFFFFFF, 0x92, 0xCF);
+
+    kernel_tss.iomap_base = sizeof(struct tss);
+#ifdef __x86_64__
+    kernel_tss.ist[0] = stack_top;
+    gdt_set_gate(GDT_TSS, (uint32_t)(uintptr_t)&kernel_tss, sizeof(struct tss) - 1, 0x89, 0x00);
+    // The upper half of a long-mode TSS descriptor holds base bits 32-63
+    *(uint64_t*)&gdt[GDT_TSS + 1] = (uint64_t)(uintptr_t)&kernel_tss >> 32;
+#else
+    kernel_tss.ss0 = 0x10;
+    gdt_set_gate(GDT_TSS, (uintptr_t)&kernel_tss, sizeof(struct tss) - 1, 0x89, 0x00);
+
+    double_fault_tss.eip = (uintptr_t)double_fault_task;
+    double_fault_tss.esp = stack_top;
+    double_fault_tss.eflags = 0x2;      // Interrupts off
+    double_fault_tss.cs = 0x08;
+    double_fault_tss.ds = double_fault_tss.es = double_fault_tss.ss = 0x10;
+    double_fault_tss.fs = double_fault_tss.gs = 0x10;
+    double_fault_tss.iomap_base = sizeof(struct tss);
+    gdt_set_gate(GDT_DF_TSS, (uintptr_t)&double_fault_tss, sizeof(struct tss) - 1, 0x89, 0x00);
+#endif
+    
+    gdt_flush();
+    asm volatile("ltr %w0" : : "r"(TSS_SELECTOR));
+}
+
+#ifndef __x86_64__
+// The double-fault task loads CR3 from its TSS; paging_init() keeps it current
+void tss_set_cr3(uintptr_t cr3) {
+    double_fault_tss.cr3 = cr3;
+}
+#endif
+
+// IDT structures
+struct idt_entry {
+    uint16_t base_low;
+    uint16_t selector;
+    uint8_t always0;
+    uint8_t flags;
+    uint16_t base_high;
+#ifdef __x86_64__
+    uint32_t base_upper;        // Long-mode gates are 16 bytes
+    uint32_t reserved;
+#endif
+} __attribute__((packed));
+
+struct idt_ptr {
+    uint16_t limit;
+    uintptr_t base;
+} __attribute__((packed));
+
+struct idt_entry idt[256];
+struct idt_ptr idtp;
+interrupt_handler_t interrupt_handlers[256];     // Read under RCU
+
+#define ISR_STUB_COUNT 48
+extern const uintptr_t isr_stub_table[ISR_STUB_COUNT];
+
+void idt_set_gate(uint8_t num, uintptr_t base, uint16_t sel, uint8_t flags) {
+    idt[num].base_low = base & 0xFFFF;
+    idt[num].base_high = (base >> 16) & 0xFFFF;
+    idt[num].selector = sel;
+    idt[num].always0 = 0;
+    idt[num].flags = flags;
+#ifdef __x86_64__
+    idt[num].base_upper = (uint32_t)(base >> 32);
+    idt[num].reserved = 0;
+#endif
+}
+
+__cold void idt_install() {
+    idtp.limit = (sizeof(struct idt_entry) * 256) - 1;
+    idtp.base = (uintptr_t)&idt;
+    
+    for (int i = 0; i < 256; i++) {
+        idt_set_gate(i, 0, 0, 0);
+    }
+    
+    for (int i = 0; i < ISR_STUB_COUNT; i++) {
+        idt_set_gate(i, isr_stub_table[i], 0x08, 0x8E);
+    }
+
+#ifdef __x86_64__
+    idt[8].always0 = 1;                         // IST1
+#else
+    idt_set_gate(8, 0, DF_TSS_SELECTOR, 0x85);  // Task gate
+#endif
+    
+    asm volatile("lidt (%0)" : : "r"(&idtp));
+}
+
+// PIC functions
+__cold void pic_remap() {
+    outb(PIC1_COMMAND, 0x11);           // ICW1: init, expect ICW4
+    outb(PIC2_COMMAND, 0x11);
+    outb(PIC1_DATA, IRQ_BASE);          // ICW2: vector offsets
+    outb(PIC2_DATA, IRQ_BASE + 8);
+    outb(PIC1_DATA, 0x04);              // ICW3: slave on IRQ2
+    outb(PIC2_DATA, 0x02);
+    outb(PIC1_DATA, 0x01);              // ICW4: 8086 mode
+    outb(PIC2_DATA, 0x01);
+
+    // Everything masked until a driver installs a handler
+    outb(PIC1_DATA, 0xFB);              // Keep the cascade line open
+    outb(PIC2_DATA, 0xFF);
+}
+
+void pic_unmask(uint8_t irq) {
+    uint16_t port = (irq < 8) ? PIC1_DATA : PIC2_DATA;
+    outb(port, inb(port) & ~(1 << (irq & 7)));
+}
+
+void irq_install_handler(uint8_t irq, interrupt_handler_t handler) {
+    rcu_assign_pointer(interrupt_handlers[IRQ_BASE + irq], handler);
+    pic_unmask(irq);
+}
+
+// Once this returns the old handler is not running anywhere
+void irq_uninstall_handler(uint8_t irq) {
+    uint16_t port = (irq < 8) ? PIC1_DATA : PIC2_DATA;
+
+    outb(port, inb(port) | (1 << (irq & 7)));
+    rcu_assign_pointer(interrupt_handlers[IRQ_BASE + irq], 0);
+    synchronize_rcu();
+}
+
+static const char* const exception_names[32] = {
+    "Divide error", "Debug", "NMI", "Breakpoint", "Overflow",
+    "BOUND range exceeded", "Invalid opcode", "Device not available",
+    "Double fault", "Coprocessor segment overrun", "Invalid TSS",
+    "Segment not present", "Stack-segment fault", "General protection fault",
+    "Page fault", "Reserved", "x87 floating-point error", "Alignment check",
+    "Machine check", "SIMD floating-point error", "Virtualization",
+    "Control protection", "Reserved", "Reserved", "Reserved", "Reserved",
+    "Reserved", "Reserved", "Hypervisor injection", "VMM communication",
+    "Security", "Reserved"
+};
+
+static __cold void register_pair(const char* name, uintptr_t value) {
+    terminal_writestring(name);
+    terminal_writestring("=");
+    terminal_writehex(value);
+    terminal_writestring(" ");
+}
+
+// Registers, control registers and a backtrace, mirrored to COM1 whatever
+// the console setting, then halt
+static __cold void exception_halt(struct registers* regs) {
+    unsigned long cr2, cr3;
+
+    asm volatile("mov %%cr2, %0" : "=r"(cr2));
+    asm volatile("mov %%cr3, %0" : "=r"(cr3));
+    if (serial_present) console_mode = CONSOLE_BOTH;
+
+    terminal_setcolor(make_color(LIGHT_RED, BLACK));
+    terminal_writestring("\nEXCEPTION: ");
+    terminal_writestring(exception_names[regs->int_no]);
+    terminal_writestring(" (error ");
+    terminal_writehex(regs->err_code);
+    terminal_writestring(") in thread ");
+    terminal_writestring(current_thread->name);
+    terminal_writestring("\n");
+#ifdef __x86_64__
+    register_pair("RIP", regs->rip);
+    register_pair("RSP", regs->rsp);
+    register_pair("RFLAGS", regs->rflags);
+    terminal_writestring("\n");
+    register_pair("RAX", regs->rax);
+    register_pair("RBX", regs->rbx);
+    register_pair("RCX", regs->rcx);
+    terminal_writestring("\n");
+    register_pair("RDX", regs->rdx);
+    register_pair("RSI", regs->rsi);
+    register_pair("RDI", regs->rdi);
+    terminal_writestring("\n");
+    register_pair("RBP", regs->rbp);
+    register_pair("R8", regs->r8);
+    register_pair("R9", regs->r9);
+    terminal_writestring("\n");
+    register_pair("R10", regs->r10);
+    register_pair("R11", regs->r11);
+    register_pair("R12", regs->r12);
+    terminal_writestring("\n");
+    register_pair("R13", regs->r13);
+    register_pair("R14", regs->r14);
+    register_pair("R15", regs->r15);
+    terminal_writestring("\n");
+#else
+    register_pair("EIP", regs->eip);
+    register_pair("ESP", regs->esp + 20);   // pusha ran after 5 more pushes
+    register_pair("EFLAGS", regs->eflags);
+    terminal_writestring("\n");
+    register_pair("EAX", regs->eax);
+    register_pair("EBX", regs->ebx);
+    register_pair("ECX", regs->ecx);
+    register_pair("EDX", regs->edx);
+    terminal_writestring("\n");
+    register_pair("ESI", regs->esi);
+    register_pair("EDI", regs->edi);
+    register_pair("EBP", regs->ebp);
+    terminal_writestring("\n");
+#endif
+    register_pair("CS", regs->cs);
+    register_pair("CR2", cr2);
+    register_pair("CR3", cr3);
+    terminal_writestring("\n");
+#ifdef __x86_64__
+    backtrace_print(regs->rip, regs->rbp);
+#else
+    backtrace_print(regs->eip, regs->ebp);
+#endif
+    terminal_writestring("System halted.\n");
+    while (1) {
+        asm volatile("cli; hlt");
+    }
+}
+
+#ifndef __x86_64__
+// Entered by task switch with the faulting context saved in kernel_tss
+static __cold __attribute__((noreturn)) void double_fault_task(void) {
+    struct registers regs = {0};
+
+    regs.int_no = 8;
+    regs.eip = kernel_tss.eip;
+    regs.esp = kernel_tss.esp - 20;     // As isr_common_stub's pusha sees it
+    regs.eflags = kernel_tss.eflags;
+    regs.eax = kernel_tss.eax;
+    regs.ebx = kernel_tss.ebx;
+    regs.ecx = kernel_tss.ecx;
+    regs.edx = kernel_tss.edx;
+    regs.esi = kernel_tss.esi;
+    regs.edi = kernel_tss.edi;
+    regs.ebp = kernel_tss.ebp;
+    regs.cs = kernel_tss.cs;
+    exception_halt(&regs);
+    __builtin_unreachable();
+}
+#endif
+
+__hot void isr_handler(struct registers* regs) {
+    // Interrupt handlers never schedule, so this is a read section as it is
+    interrupt_handler_t handler = rcu_dereference(interrupt_handlers[regs->int_no]);
+
+    if (regs->int_no >= IRQ_BASE && regs->int_no < IRQ_BASE + 16) {
+        // Acknowledge first so a handler that never returns cannot wedge the PIC
+        if (regs->int_no >= IRQ_BASE + 8) {
+            outb(PIC2_COMMAND, PIC_EOI);
+        }
+        outb(PIC1_COMMAND, PIC_EOI);
+
+        // Pending softirqs run on the way out, with interrupts back on
+        irq_enter();
+        if (handler) handler(regs);
+        irq_exit();
+        return;
+    }
+
+    if (handler) {
+        handler(regs);
+        return;
+    }
+
+    if (regs->int_no < 32) {
+        exception_halt(regs);
+    }
+}
+
+// Timer functions
+__hot static void timer_irq(struct registers* regs) {
+    timer_ticks++;
+    timekeeping_tick();
+#ifdef __x86_64__
+    prof_sample(regs->rip);
+#else
+    prof_sample(regs->eip);
+#endif
+}
+
+static void timer_apply_hz(void) {
+    uint32_t divisor = PIT_FREQUENCY / timer_hz;
+    unsigned long flags = irq_save();
+
+    timekeeping_set_hz(timer_hz);
+    outb(PIT_COMMAND, 0x36);            // Channel 0, lo/hi byte, square wave
+    outb(PIT_CHANNEL0, divisor & 0xFF);
+    outb(PIT_CHANNEL0, (divisor >> 8) & 0xFF);
+    irq_restore(flags);
+}
+
+KPARAM_INT(hz, timer_hz, 19, 10000, timer_apply_hz, "Timer interrupt frequency");
+
+__cold void timer_install() {
+    timekeeping_init();
+    timer_apply_hz();
+    irq_install_handler(0, timer_irq);
+}
+
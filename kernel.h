@@ -0,0 +1,900 @@
+// kernel.h - Declarations shared between the kernel's translation units
+
+#ifndef KERNEL_H
+#define KERNEL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Display geometry
+#define VGA_WIDTH 80
+#define VGA_HEIGHT 25
+
+// Code placement hints; linker.ld groups .text.hot and .text.unlikely
+#define __hot __attribute__((hot))
+#define __cold __attribute__((cold))
+
+// Multiboot information passed in EBX (only the fields the kernel uses)
+#define MULTIBOOT_BOOTLOADER_MAGIC 0x2BADB002
+#define MULTIBOOT_INFO_MEMORY (1 << 0)
+#define MULTIBOOT_INFO_CMDLINE (1 << 2)
+#define MULTIBOOT_INFO_MODS (1 << 3)
+#define MULTIBOOT_INFO_MEM_MAP (1 << 6)
+
+struct multiboot_info {
+    uint32_t flags;
+    uint32_t mem_lower;
+    uint32_t mem_upper;
+    uint32_t boot_device;
+    uint32_t cmdline;
+    uint32_t mods_count;
+    uint32_t mods_addr;
+    uint32_t syms[4];
+    uint32_t mmap_length;
+    uint32_t mmap_addr;
+} __attribute__((packed));
+
+struct multiboot_module {
+    uint32_t mod_start;
+    uint32_t mod_end;
+    uint32_t string;
+    uint32_t reserved;
+} __attribute__((packed));
+
+// size does not count itself; entries are walked by size + 4
+struct multiboot_mmap_entry {
+    uint32_t size;
+    uint64_t addr;
+    uint64_t len;
+    uint32_t type;
+} __attribute__((packed));
+
+// Physical memory
+//
+// All usable RAM is mapped at DIRECT_MAP_BASE (paging.c), so converting a
+// physical address to a kernel pointer is a single add. The 32-bit kernel
+// identity maps memory below DIRECT_MAP_LIMIT instead and the offset is
+// zero. With PAE the frame allocator also hands out frames above
+// DIRECT_MAP_LIMIT; those are only reachable through kmap().
+//
+// 32-bit virtual layout above the identity map:
+//   0xFF800000  kernel stacks (KSTACK_REGION_BASE)
+//   0xFFD00000  vDSO data and code pages (VDSO_BASE)
+//   0xFFE00000  kmap window (PAE)
+#define PAGE_SIZE 4096
+#define MEM_REGIONS_MAX 32
+
+#if defined(__x86_64__)
+#define DIRECT_MAP_BASE 0xFFFF888000000000UL
+#define PHYS_ADDR_LIMIT 0x0010000000000000ULL
+#define DIRECT_MAP_LIMIT PHYS_ADDR_LIMIT
+#define KSTACK_REGION_BASE 0xFFFFC90000000000UL
+#define VDSO_BASE 0x00007FFFFFFFE000UL
+#elif defined(KERNEL_PAE)
+#define DIRECT_MAP_BASE 0UL
+#define PHYS_ADDR_LIMIT 0x1000000000ULL     // 64 GiB
+#define DIRECT_MAP_LIMIT 0xFF800000ULL
+#define KSTACK_REGION_BASE 0xFF800000UL
+#define VDSO_BASE 0xFFD00000UL
+#else
+#define DIRECT_MAP_BASE 0UL
+#define PHYS_ADDR_LIMIT 0xFF800000ULL
+#define DIRECT_MAP_LIMIT PHYS_ADDR_LIMIT
+#define KSTACK_REGION_BASE 0xFF800000UL
+#define VDSO_BASE 0xFFD00000UL
+#endif
+
+// Kernel stacks: KSTACK_SLOTS slots of one unmapped guard page followed by
+// KSTACK_SIZE bytes of stack
+#define KSTACK_SIZE 16384
+#define KSTACK_SLOTS 256
+
+typedef uint64_t phys_addr_t;
+
+// User page permissions (paging_map_user_page); pages are always readable
+#define PROT_WRITE 1
+#define PROT_EXEC 2
+
+struct mem_region {
+    phys_addr_t base;
+    phys_addr_t length;
+};
+
+// NUMA (numa.c). Nodes are numbered in SRAT order; without an SRAT all
+// memory is node 0.
+#define MAX_NUMA_NODES 8
+
+struct numa_stats {
+    uint32_t local;             // Frames handed to CPUs on this node
+    uint32_t remote;            // Frames handed to CPUs on other nodes
+    uint32_t foreign;           // Wanted from this node, taken elsewhere
+};
+
+// ACPI system description table header (acpi.c)
+struct acpi_sdt_header {
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed));
+
+// Kernel threads (thread.c)
+enum thread_state {
+    THREAD_READY = 0,
+    THREAD_RUNNING,
+    THREAD_BLOCKED,
+    THREAD_DEAD
+};
+
+struct thread {
+    uintptr_t sp;               // Saved by switch_context()
+    struct thread* next;        // Run queue or zombie list
+    struct thread* wait_next;   // Wait list; a waiter can be runnable too
+    struct thread* all_next;
+    enum thread_state state;
+    uint32_t id;
+    const char* name;
+    uintptr_t stack;            // Lowest address of the KSTACK_SIZE stack
+    void (*entry)(void* arg);
+    void* arg;
+    struct pipe* in;            // Shell pipeline input, or 0
+    struct sink* out;           // Output goes here instead of the console
+};
+
+// Sleeping synchronization (sync.c). Waiters block instead of spinning;
+// wake_up() and up() may be called from interrupt handlers.
+struct wait_queue {
+    struct thread* head;        // Linked through thread.wait_next
+    struct thread* tail;
+};
+
+struct mutex {
+    struct thread* owner;
+    struct wait_queue waiters;
+};
+
+struct semaphore {
+    uint32_t count;
+    struct wait_queue waiters;
+};
+
+struct condvar {
+    struct wait_queue waiters;
+};
+
+// Sleep on wq until cond holds. cond is checked with interrupts off, so a
+// wakeup between the check and the sleep is not lost.
+#define wait_event(wq, cond)                    \
+    do {                                        \
+        unsigned long _flags = irq_save();      \
+        while (!(cond)) wait_queue_sleep(wq);   \
+        irq_restore(_flags);                    \
+    } while (0)
+
+// Read-copy-update (rcu.c). Readers take no locks: threads only switch in
+// schedule(), so a read section that does not block cannot be preempted,
+// and a CPU that passes through schedule() or idle holds no old pointers.
+// Nesting is counted per CPU, so read sections must not sleep; that
+// includes printing, since the active sink may be a pipe.
+// Writers publish with rcu_assign_pointer() and free old versions with
+// call_rcu() or after synchronize_rcu().
+struct rcu_head {
+    struct rcu_head* next;
+    void (*func)(struct rcu_head* head);
+};
+
+struct rcu_reader {
+    uint32_t nesting;
+} __attribute__((aligned(64)));
+
+#define rcu_assign_pointer(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+#define rcu_dereference(p) __atomic_load_n(&(p), __ATOMIC_CONSUME)
+
+#define container_of(ptr, type, member) \
+    ((type*)((char*)(ptr) - __builtin_offsetof(type, member)))
+
+// Singly linked RCU list; a hash table is an array of these heads.
+// Writers serialize among themselves.
+struct rcu_hnode {
+    struct rcu_hnode* next;
+};
+
+struct rcu_hlist {
+    struct rcu_hnode* first;
+};
+
+#define rcu_hlist_for_each(pos, head) \
+    for (pos = rcu_dereference((head)->first); pos; pos = rcu_dereference(pos->next))
+
+// Deferred interrupt work (softirq.c). Handlers run with interrupts on but
+// must not block.
+enum softirq_nr {
+    SOFTIRQ_HI = 0,             // tasklet_hi_schedule()
+    SOFTIRQ_TASKLET,            // tasklet_schedule()
+    SOFTIRQ_RCU,                // call_rcu() callbacks
+    NR_SOFTIRQS
+};
+
+struct tasklet {
+    struct tasklet* next;
+    void (*func)(void* arg);
+    void* arg;
+    volatile uint32_t state;    // TASKLET_SCHEDULED while queued
+};
+
+#define TASKLET_SCHEDULED 1
+
+// Workqueues (workqueue.c): functions run later in a worker thread
+struct work {
+    struct work* next;
+    void (*func)(void* arg);
+    void* arg;
+    volatile uint32_t state;    // WORK_PENDING while queued
+};
+
+#define WORK_PENDING 1
+
+struct workqueue;
+
+// Memory reclaim (reclaim.c). scan() must not block; see shrink_all().
+struct shrinker {
+    const char* name;
+    uint32_t (*count)(void);
+    uint32_t (*scan)(uint32_t nr_to_scan);
+    uint32_t freed;
+    struct shrinker* next;
+};
+
+struct reclaim_stats {
+    uint32_t wakeups;           // Free frames fell below the low watermark
+    uint32_t background;        // kreclaimd passes
+    uint32_t direct;            // Allocations that had to reclaim first
+    uint32_t failed;            // Allocations that still found nothing
+    uint32_t scanned;
+    uint32_t freed_objects;
+    uint32_t freed_frames;
+};
+
+// Boot modes selectable with mode= on the kernel command line
+enum boot_mode {
+    BOOT_MODE_SHELL = 0,    // Interactive shell (default)
+    BOOT_MODE_TEST = 1,     // Run selftest and exit QEMU with the result
+    BOOT_MODE_BENCH = 2     // Run bench and exit QEMU
+};
+
+// Where terminal output goes; selected with console= or sysctl
+enum console_mode {
+    CONSOLE_VGA = 0,
+    CONSOLE_SERIAL = 1,
+    CONSOLE_BOTH = 2
+};
+
+// Where a thread's terminal output goes instead of the console: set up
+// by the shell for pipelines and "> file" (console.c)
+enum sink_type {
+    SINK_CONSOLE,               // VGA and/or serial, per console_mode
+    SINK_SERIAL,                // COM1 only
+    SINK_NULL,
+    SINK_PIPE,
+    SINK_FILE                   // Appends to a ramfs file
+};
+
+struct sink {
+    enum sink_type type;
+    void* target;               // struct pipe or struct ramfs_file
+};
+
+#define RAMFS_NAME_MAX 32
+
+// VGA colors
+enum vga_color {
+    BLACK = 0, BLUE = 1, GREEN = 2, CYAN = 3,
+    RED = 4, MAGENTA = 5, BROWN = 6, LIGHT_GREY = 7,
+    DARK_GREY = 8, LIGHT_BLUE = 9, LIGHT_GREEN = 10, LIGHT_CYAN = 11,
+    LIGHT_RED = 12, LIGHT_MAGENTA = 13, YELLOW = 14, WHITE = 15
+};
+
+// Stack frame built by isr_common_stub in boot.asm / boot64.asm
+#ifdef __x86_64__
+struct registers {
+    uint64_t r15, r14, r13, r12, r11, r10, r9, r8;
+    uint64_t rdi, rsi, rbp, rdx, rcx, rbx, rax;
+    uint64_t int_no, err_code;
+    uint64_t rip, cs, rflags, rsp, ss;
+};
+#else
+struct registers {
+    uint32_t gs, fs, es, ds;
+    uint32_t edi, esi, ebp, esp, ebx, edx, ecx, eax;
+    uint32_t int_no, err_code;
+    uint32_t eip, cs, eflags, useresp, ss;
+};
+#endif
+
+typedef void (*interrupt_handler_t)(struct registers* regs);
+
+// Kernel parameters
+//
+// Subsystems declare tunables with KPARAM_INT, KPARAM_BOOL or KPARAM_ENUM.
+// The descriptors land in the .kparam section (see linker.ld) and can be set
+// with name=value on the kernel command line or with the sysctl command.
+enum kparam_type {
+    KPARAM_TYPE_INT,
+    KPARAM_TYPE_BOOL,
+    KPARAM_TYPE_ENUM
+};
+
+struct kparam {
+    const char* name;
+    const char* desc;
+    enum kparam_type type;
+    void* value;                // uint32_t for INT, int for BOOL, enum for ENUM
+    uint32_t min;               // Accepted range (ENUM: index into names)
+    uint32_t max;
+    const char* const* names;   // ENUM value names
+    void (*apply)(void);        // Called after a successful write, may be 0
+};
+
+#define KPARAM_DEFINE(_name, _type, _var, _min, _max, _names, _apply, _desc) \
+    static const struct kparam kparam_##_name                                \
+    __attribute__((used, section(".kparam"), aligned(sizeof(void*)))) = {    \
+        #_name, _desc, _type, &(_var), _min, _max, _names, _apply            \
+    }
+
+#define KPARAM_INT(name, var, min, max, apply, desc) \
+    KPARAM_DEFINE(name, KPARAM_TYPE_INT, var, min, max, 0, apply, desc)
+#define KPARAM_BOOL(name, var, apply, desc) \
+    KPARAM_DEFINE(name, KPARAM_TYPE_BOOL, var, 0, 1, 0, apply, desc)
+#define KPARAM_ENUM(name, var, names, apply, desc) \
+    KPARAM_DEFINE(name, KPARAM_TYPE_ENUM, var, 0, \
+                  sizeof(names) / sizeof(names[0]) - 1, names, apply, desc)
+
+extern const struct kparam __kparam_start[];
+extern const struct kparam __kparam_end[];
+
+// Port I/O functions
+static inline void outb(uint16_t port, uint8_t val) {
+    asm volatile("outb %0, %1" : : "a"(val), "Nd"(port));
+}
+
+static inline uint8_t inb(uint16_t port) {
+    uint8_t ret;
+    asm volatile("inb %1, %0" : "=a"(ret) : "Nd"(port));
+    return ret;
+}
+
+static inline __attribute__((always_inline)) uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+// Interrupt flag save/restore for short critical sections
+static inline unsigned long irq_save(void) {
+    unsigned long flags;
+    asm volatile("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static inline void irq_restore(unsigned long flags) {
+    asm volatile("push %0; popf" : : "r"(flags) : "memory", "cc");
+}
+
+static inline void cpuid(uint32_t leaf, uint32_t* a, uint32_t* b, uint32_t* c, uint32_t* d) {
+    asm volatile("cpuid" : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d) : "a"(leaf), "c"(0));
+}
+
+static inline void* phys_to_virt(phys_addr_t phys) {
+    return (void*)(uintptr_t)(phys + DIRECT_MAP_BASE);
+}
+
+// Accepts direct-map pointers and identity-mapped kernel image addresses
+static inline phys_addr_t virt_to_phys(const void* virt) {
+    uintptr_t addr = (uintptr_t)virt;
+#ifdef __x86_64__
+    if (addr >= DIRECT_MAP_BASE) return addr - DIRECT_MAP_BASE;
+#endif
+    return addr;
+}
+
+// CPUs and locking
+//
+// Only the boot CPU runs for now, so cpu_id() is constant; per-CPU data is
+// still laid out as NR_CPUS cache-line aligned slots. Spinlocks do not touch
+// the interrupt flag; use the _irqsave forms for data an IRQ handler shares.
+#define NR_CPUS 8
+
+static inline uint32_t cpu_id(void) {
+    return 0;
+}
+
+typedef struct {
+    volatile uint32_t locked;
+} spinlock_t;
+
+static inline void spin_lock(spinlock_t* lock) {
+    while (__atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE)) {
+        asm volatile("pause");
+    }
+}
+
+static inline void spin_unlock(spinlock_t* lock) {
+    __atomic_store_n(&lock->locked, 0, __ATOMIC_RELEASE);
+}
+
+static inline int spin_trylock(spinlock_t* lock) {
+    return !__atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE);
+}
+
+static inline unsigned long spin_lock_irqsave(spinlock_t* lock) {
+    unsigned long flags = irq_save();
+    spin_lock(lock);
+    return flags;
+}
+
+static inline void spin_unlock_irqrestore(spinlock_t* lock, unsigned long flags) {
+    spin_unlock(lock);
+    irq_restore(flags);
+}
+
+// Sequence locks: the writer makes the count odd while it updates, readers
+// never write and retry if the count was odd or moved. Writers must be
+// serialized by the caller (and keep interrupts off if an interrupt handler
+// also writes). x86 keeps loads and stores in order, so compiler barriers
+// are enough.
+typedef struct {
+    volatile uint32_t sequence;
+} seqlock_t;
+
+static inline void write_seqlock(seqlock_t* sl) {
+    sl->sequence++;
+    asm volatile("" ::: "memory");
+}
+
+static inline void write_sequnlock(seqlock_t* sl) {
+    asm volatile("" ::: "memory");
+    sl->sequence++;
+}
+
+static inline __attribute__((always_inline)) uint32_t read_seqbegin(const seqlock_t* sl) {
+    uint32_t seq;
+
+    while ((seq = sl->sequence) & 1) {
+        asm volatile("pause");
+    }
+    asm volatile("" ::: "memory");
+    return seq;
+}
+
+static inline __attribute__((always_inline)) int read_seqretry(const seqlock_t* sl, uint32_t seq) {
+    asm volatile("" ::: "memory");
+    return sl->sequence != seq;
+}
+
+// Timekeeping state (time.c). It fills the vDSO data page (vdso.c), which
+// is mapped read-only for user code at VDSO_BASE; the code page after it
+// holds vdso_time_ns(). ns = base_ns + (tsc - base_tsc) * mult >> shift.
+struct vdso_data {
+    seqlock_t lock;
+    uint32_t mult;              // 0 without a TSC: time moves per tick
+    uint32_t shift;
+    uint32_t tick_ns;
+    uint64_t base_tsc;
+    uint64_t base_ns;
+};
+
+union vdso_page {
+    struct vdso_data data;
+    char bytes[PAGE_SIZE];      // Nothing else shares the page
+};
+
+// Always inlined: the vDSO code page cannot call into the kernel
+static inline __attribute__((always_inline)) uint64_t vdso_read_ns(const struct vdso_data* d) {
+    uint32_t seq;
+    uint64_t ns;
+
+    do {
+        seq = read_seqbegin(&d->lock);
+        uint64_t cycles = d->mult ? rdtsc() - d->base_tsc : 0;
+        ns = d->base_ns + ((cycles * d->mult) >> d->shift);
+    } while (read_seqretry(&d->lock, seq));
+    return ns;
+}
+
+extern struct rcu_reader rcu_readers[NR_CPUS];
+
+static inline void rcu_read_lock(void) {
+    rcu_readers[cpu_id()].nesting++;
+    asm volatile("" ::: "memory");
+}
+
+static inline void rcu_read_unlock(void) {
+    asm volatile("" ::: "memory");
+    rcu_readers[cpu_id()].nesting--;
+}
+
+// The new node is fully set up before readers can reach it
+static inline void rcu_hlist_add(struct rcu_hlist* head, struct rcu_hnode* node) {
+    node->next = head->first;
+    rcu_assign_pointer(head->first, node);
+}
+
+// Readers already on node keep following its next pointer; free it only
+// after a grace period
+static inline void rcu_hlist_del(struct rcu_hlist* head, struct rcu_hnode* node) {
+    struct rcu_hnode** link = &head->first;
+
+    while (*link && *link != node) link = &(*link)->next;
+    if (*link) rcu_assign_pointer(*link, node->next);
+}
+
+// Futexes (futex.c): sleep until a 32-bit word changes. Waiters are keyed
+// by the word's physical address, so a word in a shared page is the same
+// futex wherever it is mapped. fmutex and fcond are built on them and only
+// call into futex.c when a thread has to sleep or someone is asleep.
+int futex_wait(volatile uint32_t* addr, uint32_t val);
+uint32_t futex_wake(volatile uint32_t* addr, uint32_t count);
+extern uint32_t futex_calls;
+
+struct fmutex {
+    volatile uint32_t state;            // 0 free, 1 locked, 2 locked with sleepers
+};
+
+struct fcond {
+    volatile uint32_t seq;              // Bumped by every signal
+    volatile uint32_t waiters;
+};
+
+void fmutex_lock_slow(struct fmutex* m);
+
+static inline void fmutex_lock(struct fmutex* m) {
+    uint32_t free = 0;
+
+    if (!__atomic_compare_exchange_n(&m->state, &free, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        fmutex_lock_slow(m);
+    }
+}
+
+static inline void fmutex_unlock(struct fmutex* m) {
+    if (__atomic_exchange_n(&m->state, 0, __ATOMIC_RELEASE) == 2) futex_wake(&m->state, 1);
+}
+
+static inline void fcond_signal(struct fcond* cv) {
+    __atomic_fetch_add(&cv->seq, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&cv->waiters, __ATOMIC_SEQ_CST)) futex_wake(&cv->seq, 1);
+}
+
+static inline void fcond_broadcast(struct fcond* cv) {
+    __atomic_fetch_add(&cv->seq, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&cv->waiters, __ATOMIC_SEQ_CST)) futex_wake(&cv->seq, 0xFFFFFFFF);
+}
+
+// Message channels (chan.c): a single-producer, single-consumer ring in
+// pages of its own, so it can be shared without copying. The header page
+// keeps each side's index on its own cache line; the slot page holds
+// CHAN_SLOTS messages. Sending and receiving only touch the ring. A side
+// sleeps on a full or empty ring with a futex on the other side's index,
+// which that side only wakes when the sleeper's flag is set.
+#define CHAN_SLOTS 64
+#define CHAN_SLOT_SIZE 64
+#define CHAN_MSG_MAX (CHAN_SLOT_SIZE - 4)
+
+struct chan_slot {
+    uint32_t len;
+    char data[CHAN_MSG_MAX];
+};
+
+struct chan_ring {
+    volatile uint32_t head;             // Messages published (producer)
+    volatile uint32_t reader_waiting;   // Set by a consumer going to sleep
+    char pad0[56];
+    volatile uint32_t tail;             // Messages consumed (consumer)
+    volatile uint32_t writer_waiting;   // Set by a producer going to sleep
+    char pad1[56];
+};
+
+struct chan {
+    struct chan_ring* ring;             // Header page
+    struct chan_slot* slots;            // Slot page
+    uint32_t sleeps;                    // Kernel entries to wait
+    uint32_t wakeups;                   // Kernel entries to wake the other side
+};
+
+void chan_wake_reader(struct chan* ch);
+void chan_wake_writer(struct chan* ch);
+
+// The next free slot, or 0 if the ring is full. The consumer cannot see
+// it until chan_publish().
+static inline struct chan_slot* chan_reserve(struct chan* ch) {
+    struct chan_ring* r = ch->ring;
+
+    if (r->head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == CHAN_SLOTS) return 0;
+    return &ch->slots[r->head % CHAN_SLOTS];
+}
+
+// The fence orders the head store before the flag load; the sleeper
+// orders them the other way, so one of the two sees the other
+static inline void chan_publish(struct chan* ch, uint32_t len) {
+    struct chan_ring* r = ch->ring;
+
+    ch->slots[r->head % CHAN_SLOTS].len = len;
+    __atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (r->reader_waiting) chan_wake_reader(ch);
+}
+
+// The oldest message, or 0 if the ring is empty. It stays in place until
+// chan_consume().
+static inline struct chan_slot* chan_peek(struct chan* ch) {
+    struct chan_ring* r = ch->ring;
+
+    if (__atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == r->tail) return 0;
+    return &ch->slots[r->tail % CHAN_SLOTS];
+}
+
+static inline void chan_consume(struct chan* ch) {
+    struct chan_ring* r = ch->ring;
+
+    __atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (r->writer_waiting) chan_wake_writer(ch);
+}
+
+// Color helpers
+static inline uint8_t make_color(enum vga_color fg, enum vga_color bg) {
+    return fg | bg << 4;
+}
+
+// Shared state
+extern int serial_present;
+extern int serial_input;
+extern enum console_mode console_mode;
+extern uint32_t timer_ticks;
+extern uint32_t timer_hz;
+extern uint32_t tsc_khz;
+extern struct multiboot_info* boot_info;
+extern const char* kernel_cmdline;
+extern enum boot_mode boot_mode;
+extern struct mem_region mem_regions[MEM_REGIONS_MAX];
+extern uint32_t mem_region_count;
+extern uint32_t wmark_min, wmark_low, wmark_high;
+extern struct reclaim_stats reclaim_stats;
+extern struct thread* current_thread;
+extern int numa_node_count;
+extern uint8_t numa_cpu_node[NR_CPUS];
+extern uint8_t numa_fallback[MAX_NUMA_NODES][MAX_NUMA_NODES];
+extern struct numa_stats numa_stats[MAX_NUMA_NODES];
+
+static inline int numa_node_id(void) {
+    return numa_cpu_node[cpu_id()];
+}
+
+// lib.c
+int str_len(const char* str);
+int str_cmp(const char* s1, const char* s2);
+void str_copy(char* dest, const char* src);
+int str_to_uint(const char* str, uint32_t* out);
+char* str_split_option(char* option);
+uint64_t div64_u32(uint64_t n, uint32_t d);
+const struct kparam* kparam_find(const char* name);
+int kparam_set(const struct kparam* p, const char* value);
+
+// console.c
+void serial_initialize(void);
+int serial_received(void);
+void serial_putchar(char c);
+void serial_writestring(const char* str);
+void terminal_initialize(void);
+void terminal_setcolor(uint8_t color);
+void terminal_setpos(size_t row, size_t col);
+void terminal_putchar(char c);
+void terminal_backspace(void);
+void terminal_writestring(const char* str);
+void terminal_writehex(uintptr_t value);
+void terminal_writedec(uint32_t value);
+int sink_open(struct sink* sink, const char* path, int append);
+void sink_write(struct sink* sink, const char* data, uint32_t len);
+char keyboard_scancode_to_ascii(uint8_t scancode);
+char keyboard_read_char();
+void keyboard_install(void);
+void draw_box(int x, int y, int width, int height, uint8_t color);
+void draw_progress_bar(int percentage);
+
+// interrupts.c
+void gdt_install();
+void idt_install();
+void pic_remap();
+void irq_install_handler(uint8_t irq, interrupt_handler_t handler);
+void irq_uninstall_handler(uint8_t irq);
+void timer_install();
+#ifndef __x86_64__
+void tss_set_cr3(uintptr_t cr3);
+#endif
+
+// time.c
+void timekeeping_init(void);
+void timekeeping_tick(void);
+void timekeeping_set_hz(uint32_t hz);
+uint64_t ktime_ns(void);
+uint32_t uptime_ms();
+
+// futex.c
+void fcond_wait(struct fcond* cv, struct fmutex* m);
+
+// pipe.c
+struct pipe;
+struct pipe* pipe_create(void);
+int pipe_write(struct pipe* p, const char* data, uint32_t len);
+int pipe_read(struct pipe* p, char* data, uint32_t len);
+void pipe_close_write(struct pipe* p);
+void pipe_close_read(struct pipe* p);
+
+// ramfs.c
+struct ramfs_file;
+struct ramfs_file* ramfs_lookup(const char* name);
+struct ramfs_file* ramfs_create(const char* name);
+void ramfs_truncate(struct ramfs_file* f);
+int ramfs_unlink(const char* name);
+uint32_t ramfs_size(const struct ramfs_file* f);
+uint32_t ramfs_write(struct ramfs_file* f, const char* data, uint32_t len);
+uint32_t ramfs_read(const struct ramfs_file* f, uint32_t pos, char* data, uint32_t len);
+void ramfs_report(void);
+
+// chan.c
+struct chan* chan_create(void);
+void chan_destroy(struct chan* ch);
+struct chan_slot* chan_reserve_wait(struct chan* ch);
+struct chan_slot* chan_peek_wait(struct chan* ch);
+
+// vdso.c
+typedef uint64_t (*vdso_time_fn)(void);
+extern union vdso_page vdso_page;
+extern int vdso_mapped;
+extern char __vdso_text_start[];
+uint64_t vdso_time_ns(void);
+void vdso_init(void);
+vdso_time_fn vdso_time_entry(void);
+
+// pmm.c
+int pmm_init(struct multiboot_info* mbi);
+phys_addr_t pmm_alloc_frame(void);
+phys_addr_t pmm_alloc_frame_high(void);
+phys_addr_t pmm_alloc_frame_node(int node);
+void pmm_node_reset(void);
+void pmm_node_add_range(int node, phys_addr_t base, phys_addr_t length);
+uint32_t pmm_node_free(int node);
+void pmm_free_frame(phys_addr_t frame);
+uint32_t pmm_free_count(void);
+uint32_t pmm_total_count(void);
+
+// acpi.c
+const struct acpi_sdt_header* acpi_find_table(const char* signature);
+
+// numa.c
+int numa_init(void);
+void numa_report(void);
+
+// paging.c
+int paging_init(void);
+int paging_map_page(uintptr_t virt, phys_addr_t phys);
+int paging_map_user_page(uintptr_t virt, phys_addr_t phys, uint32_t prot);
+phys_addr_t paging_unmap_page(uintptr_t virt);
+phys_addr_t paging_lookup(uintptr_t virt);
+void* kmap(phys_addr_t frame);
+void kunmap(void* addr);
+void paging_report(void);
+
+// reclaim.c
+void register_shrinker(struct shrinker* s);
+void unregister_shrinker(struct shrinker* s);
+void reclaim_set_watermarks(void);
+void reclaim_wake(void);
+uint32_t reclaim_direct(void);
+void reclaim_start(void);
+void reclaim_report(void);
+
+// slab.c
+struct kmem_cache;
+struct kmem_cache* kmem_cache_create(const char* name, uint32_t size);
+void* kmem_cache_alloc(struct kmem_cache* cache);
+void kmem_cache_free(struct kmem_cache* cache, void* obj);
+void* kmalloc(size_t size);
+void kfree(void* ptr);
+void kmem_init(void);
+void kmem_report(void);
+
+// thread.c
+void sched_init(void);
+struct thread* thread_create(const char* name, void (*entry)(void*), void* arg);
+void schedule(void);
+void thread_yield(void);
+void thread_block(void);
+void thread_wake(struct thread* t);
+void thread_exit(void) __attribute__((noreturn));
+void thread_report(void);
+uint32_t kstack_reuse_count(void);
+
+// sync.c
+void wait_queue_init(struct wait_queue* wq);
+void wait_queue_sleep(struct wait_queue* wq);
+void wake_up(struct wait_queue* wq);
+void wake_up_all(struct wait_queue* wq);
+void mutex_init(struct mutex* m);
+void mutex_lock(struct mutex* m);
+int mutex_trylock(struct mutex* m);
+void mutex_unlock(struct mutex* m);
+void sema_init(struct semaphore* sem, uint32_t count);
+void down(struct semaphore* sem);
+int down_trylock(struct semaphore* sem);
+void up(struct semaphore* sem);
+void cond_init(struct condvar* cv);
+void cond_wait(struct condvar* cv, struct mutex* m);
+void cond_signal(struct condvar* cv);
+void cond_broadcast(struct condvar* cv);
+
+// rcu.c
+void rcu_note_qs(void);
+void call_rcu(struct rcu_head* head, void (*func)(struct rcu_head*));
+void rcu_process_callbacks(void);
+void synchronize_rcu(void);
+void rcu_report(void);
+
+// softirq.c
+void open_softirq(enum softirq_nr nr, void (*handler)(void));
+void raise_softirq(enum softirq_nr nr);
+void tasklet_init(struct tasklet* t, void (*func)(void*), void* arg);
+void tasklet_schedule(struct tasklet* t);
+void tasklet_hi_schedule(struct tasklet* t);
+void irq_enter(void);
+void irq_exit(void);
+int in_interrupt(void);
+void do_softirq(void);
+void softirq_init(void);
+void softirq_report(void);
+
+// workqueue.c
+extern struct workqueue* system_wq;
+struct workqueue* workqueue_create(const char* name, uint32_t max_active);
+void work_init(struct work* w, void (*func)(void*), void* arg);
+int queue_work(struct workqueue* wq, struct work* w);
+int cancel_work(struct workqueue* wq, struct work* w);
+void flush_work(struct workqueue* wq, struct work* w);
+void flush_workqueue(struct workqueue* wq);
+void workqueue_init(void);
+void workqueue_report(void);
+
+// unwind.c
+int ksym_index(uintptr_t addr);
+const char* ksym_name(int index);
+const char* ksym_lookup(uintptr_t addr, uintptr_t* offset);
+int unwind_stack(uintptr_t bp, uintptr_t* pcs, int max);
+void backtrace_print(uintptr_t pc, uintptr_t bp);
+
+// prof.c
+void prof_sample(uintptr_t pc);
+void prof_start(void);
+void prof_stop(void);
+void prof_report(void);
+
+// shell.c
+void cmd_selftest();
+void cmd_bench();
+void cmd_exit(const char* args);
+void shell_execute(const char* line);
+void shell_run_script(const char* text, size_t size);
+void kernel_shell();
+
+// kernel.c
+void debug_exit(uint8_t code);
+
+#ifdef KERNEL_GCOV
+// gcov.c
+void gcov_dump();
+#endif
+
+#endif
@@ -0,0 +1,117 @@
+// lib.c - String helpers, arithmetic helpers and the kernel parameter registry
+
+#include "kernel.h"
+
+// String helper functions
+int str_len(const char* str) {
+    int len = 0;
+    while (str[len]) len++;
+    return len;
+}
+
+__hot int str_cmp(const char* s1, const char* s2) {
+    while (*s1 && (*s1 == *s2)) {
+        s1++;
+        s2++;
+    }
+    return *(unsigned char*)s1 - *(unsigned char*)s2;
+}
+
+void str_copy(char* dest, const char* src) {
+    while (*src) {
+        *dest++ = *src++;
+    }
+    *dest = '\0';
+}
+
+// Parse an unsigned decimal number; returns 1 on success. Numbers that do
+// not fit in 32 bits are rejected rather than wrapped.
+int str_to_uint(const char* str, uint32_t* out) {
+    uint32_t value = 0;
+    if (!*str) return 0;
+    while (*str) {
+        if (*str < '0' || *str > '9') return 0;
+        uint32_t digit = *str - '0';
+        if (value > (0xFFFFFFFFu - digit) / 10) return 0;
+        value = value * 10 + digit;
+        str++;
+    }
+    *out = value;
+    return 1;
+}
+
+// Split "key=value" in place; returns the value or 0 without '='
+char* str_split_option(char* option) {
+    while (*option && *option != '=') option++;
+    if (!*option) return 0;
+    *option = '\0';
+    return option + 1;
+}
+
+// 64-by-32 division; the kernel does not link against libgcc
+uint64_t div64_u32(uint64_t n, uint32_t d) {
+    uint32_t high = (uint32_t)(n >> 32);
+    uint32_t low = (uint32_t)n;
+    uint32_t qhigh = 0, qlow, rem;
+
+    if (high >= d) {
+        qhigh = high / d;
+        high %= d;
+    }
+    asm("divl %4" : "=a"(qlow), "=d"(rem) : "a"(low), "d"(high), "rm"(d));
+    return ((uint64_t)qhigh << 32) | qlow;
+}
+
+// Kernel parameter lookup and parsing
+const struct kparam* kparam_find(const char* name) {
+    for (const struct kparam* p = __kparam_start; p < __kparam_end; p++) {
+        if (str_cmp(p->name, name) == 0) {
+            return p;
+        }
+    }
+    return 0;
+}
+
+// Parse and store a value; returns 1 on success, 0 if it was rejected
+int kparam_set(const struct kparam* p, const char* value) {
+    uint32_t parsed;
+
+    switch (p->type) {
+    case KPARAM_TYPE_INT:
+        if (!str_to_uint(value, &parsed) || parsed < p->min || parsed > p->max) {
+            return 0;
+        }
+        *(uint32_t*)p->value = parsed;
+        break;
+    case KPARAM_TYPE_BOOL:
+        if (str_cmp(value, "1") == 0 || str_cmp(value, "on") == 0 ||
+            str_cmp(value, "yes") == 0 || str_cmp(value, "true") == 0) {
+            *(int*)p->value = 1;
+        } else if (str_cmp(value, "0") == 0 || str_cmp(value, "off") == 0 ||
+                   str_cmp(value, "no") == 0 || str_cmp(value, "false") == 0) {
+            *(int*)p->value = 0;
+        } else {
+            return 0;
+        }
+        break;
+    case KPARAM_TYPE_ENUM:
+        for (parsed = p->min; parsed <= p->max; parsed++) {
+            if (str_cmp(value, p->names[parsed]) == 0) {
+                break;
+            }
+        }
+        if (parsed > p->max) {
+            return 0;
+        }
+        *(int*)p->value = (int)parsed;
+        break;
+    default:
+        return 0;
+    }
+
+    if (p->apply) {
+        p->apply();
+    }
+    return 1;
+}
+
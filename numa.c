@@ -0,0 +1,196 @@
+// numa.c - NUMA topology from the ACPI SRAT and SLIT
+//
+// The SRAT assigns memory ranges and local APICs to proximity domains; each
+// domain seen becomes a node. The SLIT, when present, gives the relative
+// distances between them (10 = local). Every node gets a fallback list of
+// all nodes ordered by distance, which the frame allocator follows when the
+// local node is out of frames.
+
+#include "kernel.h"
+
+#define SRAT_PROCESSOR_AFFINITY 0
+#define SRAT_MEMORY_AFFINITY 1
+#define SRAT_X2APIC_AFFINITY 2
+#define SRAT_ENABLED 1
+
+#define NUMA_LOCAL_DISTANCE 10
+#define NUMA_REMOTE_DISTANCE 20
+
+struct srat_processor {
+    uint8_t type;
+    uint8_t length;
+    uint8_t domain_low;
+    uint8_t apic_id;
+    uint32_t flags;
+    uint8_t sapic_eid;
+    uint8_t domain_high[3];
+    uint32_t clock_domain;
+} __attribute__((packed));
+
+struct srat_memory {
+    uint8_t type;
+    uint8_t length;
+    uint32_t domain;
+    uint16_t reserved1;
+    uint64_t base;
+    uint64_t length_bytes;
+    uint32_t reserved2;
+    uint32_t flags;
+    uint64_t reserved3;
+} __attribute__((packed));
+
+struct srat_x2apic {
+    uint8_t type;
+    uint8_t length;
+    uint16_t reserved1;
+    uint32_t domain;
+    uint32_t x2apic_id;
+    uint32_t flags;
+    uint32_t clock_domain;
+    uint32_t reserved2;
+} __attribute__((packed));
+
+int numa_enabled = 1;
+int numa_node_count = 1;
+uint8_t numa_cpu_node[NR_CPUS];
+uint8_t numa_fallback[MAX_NUMA_NODES][MAX_NUMA_NODES];
+static uint8_t node_distance[MAX_NUMA_NODES][MAX_NUMA_NODES];
+static uint32_t node_domain[MAX_NUMA_NODES];
+
+KPARAM_BOOL(numa, numa_enabled, 0, "Use the ACPI SRAT for node-local allocation (boot only)");
+
+// Proximity domain to node number, allocating nodes in order of appearance
+static int domain_to_node(uint32_t domain) {
+    for (int node = 0; node < numa_node_count; node++) {
+        if (node_domain[node] == domain) return node;
+    }
+    if (numa_node_count == MAX_NUMA_NODES) return -1;
+    node_domain[numa_node_count] = domain;
+    return numa_node_count++;
+}
+
+static void numa_build_fallback(void) {
+    for (int node = 0; node < numa_node_count; node++) {
+        uint8_t* order = numa_fallback[node];
+        for (int i = 0; i < numa_node_count; i++) {
+            order[i] = (uint8_t)i;
+        }
+        // Selection sort by distance; ties keep node order
+        for (int i = 0; i < numa_node_count; i++) {
+            int best = i;
+            for (int j = i + 1; j < numa_node_count; j++) {
+                if (node_distance[node][order[j]] < node_distance[node][order[best]]) best = j;
+            }
+            uint8_t t = order[i];
+            order[i] = order[best];
+            order[best] = t;
+        }
+    }
+}
+
+static void numa_read_slit(void) {
+    const struct acpi_sdt_header* slit = acpi_find_table("SLIT");
+
+    for (int a = 0; a < numa_node_count; a++) {
+        for (int b = 0; b < numa_node_count; b++) {
+            node_distance[a][b] = a == b ? NUMA_LOCAL_DISTANCE : NUMA_REMOTE_DISTANCE;
+        }
+    }
+    if (!slit || slit->length < sizeof(*slit) + 8) return;
+
+    const uint8_t* body = (const uint8_t*)slit + sizeof(*slit);
+    uint64_t localities = *(const uint64_t*)body;
+    const uint8_t* matrix = body + 8;
+
+    // A matrix that does not fit in the table keeps the default distances
+    if (localities > 0xFFFF || sizeof(*slit) + 8 + localities * localities > slit->length) return;
+
+    for (int a = 0; a < numa_node_count; a++) {
+        for (int b = 0; b < numa_node_count; b++) {
+            if (node_domain[a] < localities && node_domain[b] < localities) {
+                node_distance[a][b] = matrix[node_domain[a] * localities + node_domain[b]];
+            }
+        }
+    }
+}
+
+// Returns the number of nodes; 1 when there is no usable SRAT
+__cold int numa_init(void) {
+    const struct acpi_sdt_header* srat = numa_enabled ? acpi_find_table("SRAT") : 0;
+    uint32_t cpuid_a, cpuid_b, cpuid_c, cpuid_d;
+    uint32_t boot_apic;
+    int boot_node = -1;
+    int ranges = 0;
+
+    node_distance[0][0] = NUMA_LOCAL_DISTANCE;
+    if (!srat) return 1;
+
+    cpuid(1, &cpuid_a, &cpuid_b, &cpuid_c, &cpuid_d);
+    boot_apic = cpuid_b >> 24;
+
+    // The SRAT body starts after a 4-byte revision and 8 reserved bytes
+    const uint8_t* entry = (const uint8_t*)srat + sizeof(*srat) + 12;
+    const uint8_t* end = (const uint8_t*)srat + srat->length;
+
+    // First pass only counts, so a bad table leaves the default layout
+    for (const uint8_t* p = entry; p + 2 <= end && p[1]; p += p[1]) {
+        if (p[0] == SRAT_MEMORY_AFFINITY && (((const struct srat_memory*)p)->flags & SRAT_ENABLED)) {
+            ranges++;
+        }
+    }
+    if (!ranges) return 1;
+
+    numa_node_count = 0;
+    pmm_node_reset();
+    for (const uint8_t* p = entry; p + 2 <= end && p[1]; p += p[1]) {
+        if (p[0] == SRAT_MEMORY_AFFINITY) {
+            const struct srat_memory* m = (const struct srat_memory*)p;
+            int node = (m->flags & SRAT_ENABLED) ? domain_to_node(m->domain) : -1;
+            if (node >= 0) {
+                pmm_node_add_range(node, m->base, m->length_bytes);
+            }
+        } else if (p[0] == SRAT_PROCESSOR_AFFINITY) {
+            const struct srat_processor* c = (const struct srat_processor*)p;
+            uint32_t domain = c->domain_low | (uint32_t)c->domain_high[0] << 8 |
+                              (uint32_t)c->domain_high[1] << 16 | (uint32_t)c->domain_high[2] << 24;
+            if ((c->flags & SRAT_ENABLED) && c->apic_id == boot_apic) {
+                boot_node = domain_to_node(domain);
+            }
+        } else if (p[0] == SRAT_X2APIC_AFFINITY) {
+            const struct srat_x2apic* c = (const struct srat_x2apic*)p;
+            if ((c->flags & SRAT_ENABLED) && c->x2apic_id == boot_apic) {
+                boot_node = domain_to_node(c->domain);
+            }
+        }
+    }
+
+    // Only the boot CPU runs; the others stay on node 0 until they exist
+    numa_cpu_node[0] = boot_node > 0 ? (uint8_t)boot_node : 0;
+
+    numa_read_slit();
+    numa_build_fallback();
+    return numa_node_count;
+}
+
+void numa_report(void) {
+    terminal_writestring("node  free MB  local  remote  foreign  distances\n");
+    for (int node = 0; node < numa_node_count; node++) {
+        terminal_writedec(node);
+        terminal_writestring(node == numa_node_id() ? "*     " : "      ");
+        terminal_writedec(pmm_node_free(node) / (1024 * 1024 / PAGE_SIZE));
+        terminal_writestring("  ");
+        terminal_writedec(numa_stats[node].local);
+        terminal_writestring("  ");
+        terminal_writedec(numa_stats[node].remote);
+        terminal_writestring("  ");
+        terminal_writedec(numa_stats[node].foreign);
+        terminal_writestring(" ");
+        for (int other = 0; other < numa_node_count; other++) {
+            terminal_writestring(" ");
+            terminal_writedec(node_distance[node][other]);
+        }
+        terminal_putchar('\n');
+    }
+    terminal_writestring("local: frames given to CPUs on this node; remote: to CPUs on other\n"
+                         "nodes; foreign: wanted here but taken elsewhere. * = current node\n");
+}
@@ -0,0 +1,449 @@
+// paging.c - Kernel page tables and the physical memory direct map
+//
+// x86-64 keeps the boot identity map of the low 4 GiB and adds every usable
+// RAM region at DIRECT_MAP_BASE, using 1 GiB pages where the CPU has them,
+// then 2 MiB, then 4 KiB for unaligned edges. The 32-bit kernel turns on
+// paging with a PSE identity map of the whole 4 GiB in 4 MiB pages, or with
+// KERNEL_PAE, 2 MiB pages up to DIRECT_MAP_LIMIT plus a kmap window for
+// frames beyond it. Single pages (kernel stacks, guard pages) go through
+// paging_map_page() and paging_unmap_page(), which split huge pages as
+// needed.
+//
+// When the CPU has NX, everything except the kernel's .text is mapped
+// non-executable; the image itself is mapped with 4 KiB pages so .text and
+// .rodata can also be read-only.
+
+#include "kernel.h"
+
+#define PTE_PRESENT 0x001
+#define PTE_WRITE   0x002
+#define PTE_USER    0x004
+#define PTE_HUGE    0x080   // PS bit: leaf entry above the page table level
+#define PTE_GLOBAL  0x100
+#define PTE_NX      (1ULL << 63)
+
+#if defined(__x86_64__)
+typedef uint64_t pte_t;
+#define PT_LEVELS 4
+#define PT_INDEX_BITS 9
+#define PTE_ADDR_MASK 0x000FFFFFFFFFF000ULL
+#elif defined(KERNEL_PAE)
+// The top level is the 4-entry PDPT; the walk masks its index like the others
+typedef uint64_t pte_t;
+#define PT_LEVELS 3
+#define PT_INDEX_BITS 9
+#define PTE_ADDR_MASK 0x000FFFFFFFFFF000ULL
+#define KMAP_BASE 0xFFE00000U
+#define KMAP_SLOTS 512
+#else
+typedef uint32_t pte_t;
+#define PT_LEVELS 2
+#define PT_INDEX_BITS 10
+#define PTE_ADDR_MASK 0xFFFFF000U
+#endif
+
+#define PT_ENTRIES (1U << PT_INDEX_BITS)
+#define LEVEL_SHIFT(level) (12 + (level) * PT_INDEX_BITS)
+#define LEVEL_SIZE(level) ((phys_addr_t)1 << LEVEL_SHIFT(level))
+#define LEVEL_INDEX(virt, level) (((virt) >> LEVEL_SHIFT(level)) & (PT_ENTRIES - 1))
+
+#define CR0_WP (1UL << 16)
+#define CR0_PG (1UL << 31)
+#define CR4_PSE (1UL << 4)
+#define CR4_PAE (1UL << 5)
+#define CR4_PGE (1UL << 7)
+
+#define MSR_EFER 0xC0000080
+#define EFER_NXE (1U << 11)
+
+extern char _kernel_start[];
+extern char _text_end[];
+extern char _rodata_end[];
+extern char _kernel_end[];
+extern char boot_stack_guard[];
+
+static pte_t* kernel_root = 0;              // PML4 or page directory
+static int huge_level = 0;                  // Highest level that may hold a leaf
+static pte_t global_flag = 0;
+static pte_t nx_flag = 0;
+static int direct_map_ready = 0;
+static uint32_t table_frames = 0;
+static uint32_t direct_map_count[PT_LEVELS];    // Leaf entries per level
+#ifdef KERNEL_PAE
+static pte_t* kmap_ptes = 0;                // Page table behind the kmap window
+#endif
+
+static inline unsigned long read_cr0(void) {
+    unsigned long v;
+    asm volatile("mov %%cr0, %0" : "=r"(v));
+    return v;
+}
+
+static inline void write_cr0(unsigned long v) {
+    asm volatile("mov %0, %%cr0" : : "r"(v) : "memory");
+}
+
+static inline unsigned long read_cr3(void) {
+    unsigned long v;
+    asm volatile("mov %%cr3, %0" : "=r"(v));
+    return v;
+}
+
+static inline void write_cr3(unsigned long v) {
+    asm volatile("mov %0, %%cr3" : : "r"(v) : "memory");
+}
+
+static inline unsigned long read_cr4(void) {
+    unsigned long v;
+    asm volatile("mov %%cr4, %0" : "=r"(v));
+    return v;
+}
+
+static inline void write_cr4(unsigned long v) {
+    asm volatile("mov %0, %%cr4" : : "r"(v) : "memory");
+}
+
+static inline uint64_t rdmsr(uint32_t msr) {
+    uint32_t lo, hi;
+    asm volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+    asm volatile("wrmsr" : : "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)));
+}
+
+static inline void invlpg(uintptr_t virt) {
+    asm volatile("invlpg (%0)" : : "r"(virt) : "memory");
+}
+
+// Until the direct map is live, tables are reached through the identity map
+static pte_t* table_virt(phys_addr_t phys) {
+    return direct_map_ready ? phys_to_virt(phys) : (pte_t*)(uintptr_t)phys;
+}
+
+static pte_t alloc_table(void) {
+    phys_addr_t frame = pmm_alloc_frame();
+
+    if (!frame || (!direct_map_ready && frame >= 0x100000000ULL)) return 0;
+
+    pte_t* table = table_virt(frame);
+    for (uint32_t i = 0; i < PT_ENTRIES; i++) {
+        table[i] = 0;
+    }
+    table_frames++;
+    return (pte_t)frame | PTE_PRESENT | PTE_WRITE;
+}
+
+// Replace a huge leaf with a table of next-size pages mapping the same range
+static int paging_split(pte_t* entry, int level) {
+    pte_t huge = *entry;
+    pte_t flags = huge & ~PTE_ADDR_MASK & ~(pte_t)PTE_HUGE;
+    pte_t table = alloc_table();
+
+    if (!table) return 0;
+
+    pte_t* child = table_virt(table & PTE_ADDR_MASK);
+    for (uint32_t i = 0; i < PT_ENTRIES; i++) {
+        child[i] = ((huge & PTE_ADDR_MASK) + i * LEVEL_SIZE(level - 1)) | flags |
+                   (level - 1 ? PTE_HUGE : 0);
+    }
+    *entry = table;
+    return 1;
+}
+
+// Returns the entry that maps virt at the given level, creating the tables
+// above it and splitting any larger page in the way. user (PTE_USER or 0)
+// is added to the entries on the way; the leaf decides the real access.
+static pte_t* paging_walk(uintptr_t virt, int level, pte_t user) {
+    pte_t* table = kernel_root;
+
+    for (int l = PT_LEVELS - 1; l > level; l--) {
+        pte_t* entry = &table[LEVEL_INDEX(virt, l)];
+        if (!(*entry & PTE_PRESENT)) {
+            *entry = alloc_table();
+            if (!*entry) return 0;
+        } else if (*entry & PTE_HUGE) {
+            if (!paging_split(entry, l)) return 0;
+        }
+#ifdef KERNEL_PAE
+        // PDPT entries have no access bits; RW and US there are reserved
+        if (l == PT_LEVELS - 1) *entry &= ~(pte_t)(PTE_WRITE | PTE_USER);
+        else *entry |= user;
+#else
+        *entry |= user;
+#endif
+        table = table_virt(*entry & PTE_ADDR_MASK);
+    }
+    return &table[LEVEL_INDEX(virt, level)];
+}
+
+// Map one 4 KiB kernel data page
+int paging_map_page(uintptr_t virt, phys_addr_t phys) {
+    if (!direct_map_ready) return 0;
+
+    unsigned long flags = irq_save();
+    pte_t* pte = paging_walk(virt, 0, 0);
+
+    if (pte) {
+        *pte = (pte_t)phys | PTE_PRESENT | PTE_WRITE | nx_flag | global_flag;
+        invlpg(virt);
+    }
+    irq_restore(flags);
+    return pte != 0;
+}
+
+// Map one 4 KiB page that user code may access; prot is PROT_WRITE and
+// PROT_EXEC. The kernel can always read it.
+int paging_map_user_page(uintptr_t virt, phys_addr_t phys, uint32_t prot) {
+    if (!direct_map_ready) return 0;
+
+    unsigned long flags = irq_save();
+    pte_t* pte = paging_walk(virt, 0, PTE_USER);
+
+    if (pte) {
+        *pte = (pte_t)phys | PTE_PRESENT | PTE_USER | global_flag |
+               ((prot & PROT_WRITE) ? PTE_WRITE : 0) | ((prot & PROT_EXEC) ? 0 : nx_flag);
+        invlpg(virt);
+    }
+    irq_restore(flags);
+    return pte != 0;
+}
+
+// The physical address virt translates to, or 0 if nothing is mapped
+// there. Before the direct map is live, kernel addresses are physical.
+phys_addr_t paging_lookup(uintptr_t virt) {
+    if (!direct_map_ready) return virt_to_phys((const void*)virt);
+
+    unsigned long flags = irq_save();
+    pte_t* table = kernel_root;
+    phys_addr_t phys = 0;
+
+    for (int l = PT_LEVELS - 1; l >= 0; l--) {
+        pte_t entry = table[LEVEL_INDEX(virt, l)];
+        if (!(entry & PTE_PRESENT)) break;
+        if (l == 0 || (entry & PTE_HUGE)) {
+            phys = (entry & PTE_ADDR_MASK & ~(LEVEL_SIZE(l) - 1)) | (virt & (LEVEL_SIZE(l) - 1));
+            break;
+        }
+        table = table_virt(entry & PTE_ADDR_MASK);
+    }
+    irq_restore(flags);
+    return phys;
+}
+
+// Returns the frame that was mapped at virt, or 0
+phys_addr_t paging_unmap_page(uintptr_t virt) {
+    if (!direct_map_ready) return 0;
+
+    unsigned long flags = irq_save();
+    pte_t* pte = paging_walk(virt, 0, 0);
+    phys_addr_t phys = 0;
+
+    if (pte && (*pte & PTE_PRESENT)) {
+        phys = *pte & PTE_ADDR_MASK;
+        *pte = 0;
+        invlpg(virt);
+    }
+    irq_restore(flags);
+    return phys;
+}
+
+// Map [virt, virt + size) to phys using the largest page each step allows
+static int paging_map_range(uintptr_t virt, phys_addr_t phys, phys_addr_t size,
+                            pte_t flags, uint32_t* counts) {
+    while (size) {
+        int level = huge_level;
+        while (level > 0 && (((virt | phys) & (LEVEL_SIZE(level) - 1)) ||
+                             size < LEVEL_SIZE(level))) {
+            level--;
+        }
+
+        pte_t* pte = paging_walk(virt, level, 0);
+        if (!pte) return 0;
+        *pte = (pte_t)phys | flags | global_flag | (level ? PTE_HUGE : 0);
+        if (counts) counts[level]++;
+
+        virt += LEVEL_SIZE(level);
+        phys += LEVEL_SIZE(level);
+        size -= LEVEL_SIZE(level);
+    }
+    return 1;
+}
+
+#ifndef __x86_64__
+static phys_addr_t page_align_up(uintptr_t addr) {
+    return (addr + PAGE_SIZE - 1) & ~(uintptr_t)(PAGE_SIZE - 1);
+}
+
+// Identity map [0, limit); the kernel image gets 4 KiB pages with per-section
+// permissions so the rest can use the largest pages
+static int paging_map_identity(phys_addr_t limit) {
+    phys_addr_t kstart = (uintptr_t)_kernel_start;
+    phys_addr_t text_end = page_align_up((uintptr_t)_text_end);
+    phys_addr_t rodata_end = page_align_up((uintptr_t)_rodata_end);
+    phys_addr_t kend = page_align_up((uintptr_t)_kernel_end);
+    pte_t data = PTE_PRESENT | PTE_WRITE | nx_flag;
+
+    return paging_map_range(0, 0, kstart, data, direct_map_count) &&
+           paging_map_range(kstart, kstart, text_end - kstart, PTE_PRESENT, direct_map_count) &&
+           paging_map_range(text_end, text_end, rodata_end - text_end, PTE_PRESENT | nx_flag,
+                            direct_map_count) &&
+           paging_map_range(rodata_end, rodata_end, kend - rodata_end, data, direct_map_count) &&
+           paging_map_range(kend, kend, limit - kend, data, direct_map_count);
+}
+#endif
+
+__cold int paging_init(void) {
+    uint32_t eax, ebx, ecx, edx;
+    uint32_t features;
+
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    features = edx;
+    if (features & (1U << 13)) {
+        global_flag = PTE_GLOBAL;
+    }
+
+    cpuid(0x80000000, &eax, &ebx, &ecx, &edx);
+    uint32_t ext_edx = 0;
+    if (eax >= 0x80000001) {
+        cpuid(0x80000001, &eax, &ebx, &ecx, &edx);
+        ext_edx = edx;
+    }
+
+#if defined(__x86_64__) || defined(KERNEL_PAE)
+    if (ext_edx & (1U << 20)) {
+        wrmsr(MSR_EFER, rdmsr(MSR_EFER) | EFER_NXE);
+        nx_flag = PTE_NX;
+    }
+#endif
+
+#if defined(__x86_64__)
+    // 2 MiB pages always exist in long mode; 1 GiB needs pdpe1gb
+    huge_level = (ext_edx & (1U << 26)) ? 2 : 1;
+
+    kernel_root = (pte_t*)(read_cr3() & PTE_ADDR_MASK);
+    for (uint32_t i = 0; i < mem_region_count; i++) {
+        if (!paging_map_range(DIRECT_MAP_BASE + mem_regions[i].base, mem_regions[i].base,
+                              mem_regions[i].length, PTE_PRESENT | PTE_WRITE | nx_flag,
+                              direct_map_count)) {
+            return 0;
+        }
+    }
+
+    if (global_flag) write_cr4(read_cr4() | CR4_PGE);
+    write_cr3(read_cr3());
+#elif defined(KERNEL_PAE)
+    if (!(features & (1U << 6))) return 0;
+    huge_level = 1;
+
+    // The PDPT only needs 32-byte alignment, but a frame is simplest
+    pte_t root = alloc_table();
+    if (!root) return 0;
+    kernel_root = table_virt(root & PTE_ADDR_MASK);
+    if (!paging_map_identity(DIRECT_MAP_LIMIT)) return 0;
+
+    kmap_ptes = paging_walk(KMAP_BASE, 0, 0);
+    if (!kmap_ptes) return 0;
+
+    write_cr4(read_cr4() | CR4_PAE | (global_flag ? CR4_PGE : 0));
+    write_cr3(root & PTE_ADDR_MASK);
+    tss_set_cr3(root & PTE_ADDR_MASK);
+    write_cr0(read_cr0() | CR0_PG | CR0_WP);
+#else
+    // Without PSE the identity map would need 4 MiB of page tables
+    if (!(features & (1U << 3))) return 0;
+    huge_level = 1;
+    (void)ext_edx;
+
+    pte_t root = alloc_table();
+    if (!root) return 0;
+    kernel_root = table_virt(root & PTE_ADDR_MASK);
+    if (!paging_map_identity(DIRECT_MAP_LIMIT)) return 0;
+
+    write_cr3(root & PTE_ADDR_MASK);
+    tss_set_cr3(root & PTE_ADDR_MASK);
+    write_cr4(read_cr4() | CR4_PSE | (global_flag ? CR4_PGE : 0));
+    write_cr0(read_cr0() | CR0_PG | CR0_WP);
+#endif
+
+    direct_map_ready = 1;
+    paging_unmap_page((uintptr_t)boot_stack_guard);
+    return 1;
+}
+
+// Pointer to any frame: directly mapped frames come straight from the direct
+// map, others take a kmap window slot until kunmap(). Returns 0 when the
+// window is full.
+void* kmap(phys_addr_t frame) {
+    if (frame < DIRECT_MAP_LIMIT) {
+        return phys_to_virt(frame);
+    }
+#ifdef KERNEL_PAE
+    unsigned long flags = irq_save();
+    for (uint32_t i = 0; kmap_ptes && i < KMAP_SLOTS; i++) {
+        if (!(kmap_ptes[i] & PTE_PRESENT)) {
+            uintptr_t virt = KMAP_BASE + i * PAGE_SIZE;
+            kmap_ptes[i] = (frame & PTE_ADDR_MASK) | PTE_PRESENT | PTE_WRITE | nx_flag;
+            invlpg(virt);
+            irq_restore(flags);
+            return (void*)virt;
+        }
+    }
+    irq_restore(flags);
+#endif
+    return 0;
+}
+
+void kunmap(void* addr) {
+#ifdef KERNEL_PAE
+    uintptr_t virt = (uintptr_t)addr;
+    if (kmap_ptes && virt >= KMAP_BASE) {
+        kmap_ptes[(virt - KMAP_BASE) / PAGE_SIZE] = 0;
+        invlpg(virt);
+    }
+#else
+    (void)addr;
+#endif
+}
+
+static void write_page_size(int level) {
+    phys_addr_t size = LEVEL_SIZE(level);
+
+    if (size >= (1U << 30)) {
+        terminal_writedec((uint32_t)(size >> 30));
+        terminal_writestring("G");
+    } else if (size >= (1U << 20)) {
+        terminal_writedec((uint32_t)(size >> 20));
+        terminal_writestring("M");
+    } else {
+        terminal_writedec((uint32_t)(size >> 10));
+        terminal_writestring("K");
+    }
+}
+
+void paging_report(void) {
+    phys_addr_t mapped = 0;
+
+    if (!direct_map_ready) {
+        terminal_writestring("Paging: disabled\n");
+        return;
+    }
+
+    terminal_writestring("Direct map at ");
+    terminal_writehex(DIRECT_MAP_BASE);
+    terminal_writestring("\n");
+    for (int level = huge_level; level >= 0; level--) {
+        terminal_writestring("  ");
+        write_page_size(level);
+        terminal_writestring(" pages: ");
+        terminal_writedec(direct_map_count[level]);
+        terminal_writestring("\n");
+        mapped += direct_map_count[level] * LEVEL_SIZE(level);
+    }
+    terminal_writestring("  Mapped: ");
+    terminal_writedec((uint32_t)(mapped >> 20));
+    terminal_writestring(" MB, page table frames: ");
+    terminal_writedec(table_frames);
+    terminal_writestring(nx_flag ? ", NX on\n" : ", NX off\n");
+}
@@ -0,0 +1,100 @@
+// pipe.c - Bounded byte pipes between threads
+//
+// A pipe is a one-page ring buffer with a reader end and a writer end.
+// Writers sleep while it is full and readers while it is empty, so a fast
+// producer is held to the pace of its consumer and never needs more than
+// the one page. Closing the writer end lets the reader drain what is left
+// and then see end of file; closing the reader end makes further writes
+// fail instead of blocking forever. The pipe is freed once both are closed.
+
+#include "kernel.h"
+
+#define PIPE_SIZE PAGE_SIZE
+
+struct pipe {
+    char* buf;
+    uint32_t head;                      // Bytes written
+    uint32_t tail;                      // Bytes read
+    int reader_open;
+    int writer_open;
+    struct wait_queue readable;
+    struct wait_queue writable;
+};
+
+struct pipe* pipe_create(void) {
+    struct pipe* p = kmalloc(sizeof(*p));
+    phys_addr_t frame = p ? pmm_alloc_frame() : 0;
+
+    if (!frame) {
+        kfree(p);
+        return 0;
+    }
+    p->buf = phys_to_virt(frame);
+    p->head = 0;
+    p->tail = 0;
+    p->reader_open = 1;
+    p->writer_open = 1;
+    wait_queue_init(&p->readable);
+    wait_queue_init(&p->writable);
+    return p;
+}
+
+static void pipe_free(struct pipe* p) {
+    pmm_free_frame(virt_to_phys(p->buf));
+    kfree(p);
+}
+
+// Thread context. Returns len, or -1 once the reader end is closed (what
+// was copied before that is still delivered).
+int pipe_write(struct pipe* p, const char* data, uint32_t len) {
+    uint32_t done = 0;
+
+    while (done < len) {
+        wait_event(&p->writable, p->head - p->tail < PIPE_SIZE || !p->reader_open);
+        if (!p->reader_open) return -1;
+
+        unsigned long flags = irq_save();
+        while (done < len && p->head - p->tail < PIPE_SIZE) {
+            p->buf[p->head++ % PIPE_SIZE] = data[done++];
+        }
+        wake_up(&p->readable);
+        irq_restore(flags);
+    }
+    return (int)len;
+}
+
+// Thread context. Sleeps until there is data, then returns up to len
+// bytes; returns 0 at end of file.
+int pipe_read(struct pipe* p, char* data, uint32_t len) {
+    uint32_t done = 0;
+
+    wait_event(&p->readable, p->head != p->tail || !p->writer_open);
+
+    unsigned long flags = irq_save();
+    while (done < len && p->tail != p->head) {
+        data[done++] = p->buf[p->tail++ % PIPE_SIZE];
+    }
+    wake_up(&p->writable);
+    irq_restore(flags);
+    return (int)done;
+}
+
+void pipe_close_write(struct pipe* p) {
+    unsigned long flags = irq_save();
+    int last = !p->reader_open;
+
+    p->writer_open = 0;
+    wake_up_all(&p->readable);
+    irq_restore(flags);
+    if (last) pipe_free(p);
+}
+
+void pipe_close_read(struct pipe* p) {
+    unsigned long flags = irq_save();
+    int last = !p->writer_open;
+
+    p->reader_open = 0;
+    wake_up_all(&p->writable);
+    irq_restore(flags);
+    if (last) pipe_free(p);
+}
@@ -0,0 +1,340 @@
+// pmm.c - Physical frame allocator
+//
+// One bit per 4 KiB frame (1 = in use), built from the multiboot memory map.
+// The bitmap lives in the first free pages after the kernel image and boot
+// modules. Allocation is next-fit and skips full 32-frame words at a time.
+// Frames above DIRECT_MAP_LIMIT (PAE only) form a separate high zone that
+// pmm_alloc_frame_high() drains first, keeping directly mapped frames for
+// callers that need a pointer.
+//
+// Each NUMA node owns ranges of bitmap words (numa.c fills them in from the
+// SRAT; without one, node 0 owns everything). Allocations search the
+// calling CPU's node first, then the others in distance order.
+
+#include "kernel.h"
+
+#define MULTIBOOT_MEMORY_AVAILABLE 1
+
+extern char _kernel_start[];
+extern char _kernel_end[];
+
+static uint32_t* frame_bitmap = 0;
+static uint32_t frame_count = 0;       // Frames covered by the bitmap
+static uint32_t free_frames = 0;
+static uint32_t total_frames = 0;      // Usable frames at boot
+static uint32_t bitmap_words = 0;
+static uint32_t low_words = 0;         // Bitmap words below DIRECT_MAP_LIMIT
+
+#define PMM_NODE_RANGES 8
+
+struct pmm_range {
+    uint32_t first;                    // Bitmap words [first, end)
+    uint32_t end;
+    uint32_t hint;                     // Next-fit search start
+};
+
+struct pmm_node {
+    struct pmm_range ranges[PMM_NODE_RANGES];
+    uint32_t range_count;
+};
+
+static struct pmm_node pmm_nodes[MAX_NUMA_NODES];
+struct numa_stats numa_stats[MAX_NUMA_NODES];
+
+struct mem_region mem_regions[MEM_REGIONS_MAX];
+uint32_t mem_region_count = 0;
+
+static inline void frame_set(uint32_t pfn) {
+    frame_bitmap[pfn / 32] |= 1U << (pfn % 32);
+}
+
+static inline void frame_clear(uint32_t pfn) {
+    frame_bitmap[pfn / 32] &= ~(1U << (pfn % 32));
+}
+
+static inline int frame_test(uint32_t pfn) {
+    return (frame_bitmap[pfn / 32] >> (pfn % 32)) & 1;
+}
+
+static void mem_region_add(phys_addr_t base, phys_addr_t length) {
+    phys_addr_t end = base + length;
+
+    // Only whole frames below the addressable limit are usable
+    base = (base + PAGE_SIZE - 1) & ~(phys_addr_t)(PAGE_SIZE - 1);
+    end &= ~(phys_addr_t)(PAGE_SIZE - 1);
+    if (end > PHYS_ADDR_LIMIT) end = PHYS_ADDR_LIMIT;
+    if (end <= base || mem_region_count == MEM_REGIONS_MAX) return;
+
+    mem_regions[mem_region_count].base = base;
+    mem_regions[mem_region_count].length = end - base;
+    mem_region_count++;
+}
+
+// Mark [start, end) in use; ranges outside the bitmap are ignored
+static void pmm_reserve(phys_addr_t start, phys_addr_t end) {
+    uint32_t first = (uint32_t)(start / PAGE_SIZE);
+    uint32_t last = (uint32_t)((end + PAGE_SIZE - 1) / PAGE_SIZE);
+
+    if (last > frame_count) last = frame_count;
+    for (uint32_t pfn = first; pfn < last; pfn++) {
+        if (!frame_test(pfn)) {
+            frame_set(pfn);
+            free_frames--;
+        }
+    }
+}
+
+static phys_addr_t max_addr(phys_addr_t a, phys_addr_t b) {
+    return a > b ? a : b;
+}
+
+// Off boots as if the loader gave no memory information (make test-nomem)
+static int pmm_memmap = 1;
+KPARAM_BOOL(memmap, pmm_memmap, 0, "Use the loader's memory map (boot only)");
+
+__cold int pmm_init(struct multiboot_info* mbi) {
+    phys_addr_t highest = 0;
+    phys_addr_t placement = (uintptr_t)_kernel_end;
+    uint32_t words;
+
+    if (!mbi || !pmm_memmap) return 0;
+
+    if (mbi->flags & MULTIBOOT_INFO_MEM_MAP) {
+        uintptr_t entry = mbi->mmap_addr;
+        uintptr_t end = mbi->mmap_addr + mbi->mmap_length;
+
+        while (entry < end) {
+            struct multiboot_mmap_entry* e = (struct multiboot_mmap_entry*)entry;
+            if (e->type == MULTIBOOT_MEMORY_AVAILABLE) {
+                mem_region_add(e->addr, e->len);
+            }
+            entry += e->size + sizeof(e->size);
+        }
+        placement = max_addr(placement, end);
+    } else if (mbi->flags & MULTIBOOT_INFO_MEMORY) {
+        mem_region_add(0, (phys_addr_t)mbi->mem_lower * 1024);
+        mem_region_add(0x100000, (phys_addr_t)mbi->mem_upper * 1024);
+    }
+
+    for (uint32_t i = 0; i < mem_region_count; i++) {
+        highest = max_addr(highest, mem_regions[i].base + mem_regions[i].length);
+    }
+    if (highest == 0) return 0;
+
+    // The bitmap goes after everything the loader handed us
+    placement = max_addr(placement, (uintptr_t)mbi + sizeof(*mbi));
+    if (mbi->flags & MULTIBOOT_INFO_CMDLINE) {
+        placement = max_addr(placement, mbi->cmdline + str_len((const char*)(uintptr_t)mbi->cmdline) + 1);
+    }
+    if (mbi->flags & MULTIBOOT_INFO_MODS) {
+        struct multiboot_module* mods = (struct multiboot_module*)(uintptr_t)mbi->mods_addr;
+        placement = max_addr(placement, mbi->mods_addr + mbi->mods_count * sizeof(*mods));
+        for (uint32_t i = 0; i < mbi->mods_count; i++) {
+            placement = max_addr(placement, mods[i].mod_end);
+            if (mods[i].string) {
+                placement = max_addr(placement, mods[i].string + str_len((const char*)(uintptr_t)mods[i].string) + 1);
+            }
+        }
+    }
+    placement = (placement + PAGE_SIZE - 1) & ~(phys_addr_t)(PAGE_SIZE - 1);
+
+    frame_count = (uint32_t)(highest / PAGE_SIZE);
+    words = (frame_count + 31) / 32;
+
+    // It has to fit in usable memory that the boot page tables reach
+    int fits = 0;
+    for (uint32_t i = 0; i < mem_region_count; i++) {
+        phys_addr_t end = mem_regions[i].base + mem_regions[i].length;
+        if (placement >= mem_regions[i].base && placement + words * 4 <= end &&
+            placement + words * 4 <= 0x100000000ULL) {
+            fits = 1;
+        }
+    }
+    if (!fits) return 0;
+
+    // Everything starts in use; usable regions are then released
+    frame_bitmap = (uint32_t*)(uintptr_t)placement;
+    for (uint32_t i = 0; i < words; i++) {
+        frame_bitmap[i] = 0xFFFFFFFF;
+    }
+    for (uint32_t i = 0; i < mem_region_count; i++) {
+        uint32_t first = (uint32_t)(mem_regions[i].base / PAGE_SIZE);
+        uint32_t last = first + (uint32_t)(mem_regions[i].length / PAGE_SIZE);
+        for (uint32_t pfn = first; pfn < last; pfn++) {
+            frame_clear(pfn);
+            free_frames++;
+        }
+    }
+
+    // Real-mode area, kernel image, boot data and the bitmap itself
+    pmm_reserve(0, 0x100000);
+    pmm_reserve((uintptr_t)_kernel_start, placement + words * 4);
+
+    total_frames = free_frames;
+    low_words = words;
+    if ((phys_addr_t)words * 32 * PAGE_SIZE > DIRECT_MAP_LIMIT) {
+        low_words = (uint32_t)(DIRECT_MAP_LIMIT / PAGE_SIZE / 32);
+    }
+    bitmap_words = words;
+    pmm_node_reset();
+    pmm_node_add_range(0, 0, (phys_addr_t)frame_count * PAGE_SIZE);
+    reclaim_set_watermarks();
+    return 1;
+}
+
+void pmm_node_reset(void) {
+    for (int node = 0; node < MAX_NUMA_NODES; node++) {
+        pmm_nodes[node].range_count = 0;
+    }
+}
+
+// Words shared with a neighbouring range can be handed out by either node
+void pmm_node_add_range(int node, phys_addr_t base, phys_addr_t length) {
+    struct pmm_node* n = &pmm_nodes[node];
+    phys_addr_t first = base / PAGE_SIZE / 32;
+    phys_addr_t end = ((base + length) / PAGE_SIZE + 31) / 32;
+
+    if (end > bitmap_words) end = bitmap_words;
+    if (first >= end || n->range_count == PMM_NODE_RANGES) return;
+
+    n->ranges[n->range_count].first = (uint32_t)first;
+    n->ranges[n->range_count].end = (uint32_t)end;
+    n->ranges[n->range_count].hint = (uint32_t)first;
+    n->range_count++;
+}
+
+// __builtin_popcount would need libgcc without -mpopcnt
+static inline uint32_t popcount32(uint32_t v) {
+    v = v - ((v >> 1) & 0x55555555);
+    v = (v & 0x33333333) + ((v >> 2) & 0x33333333);
+    return (((v + (v >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24;
+}
+
+uint32_t pmm_node_free(int node) {
+    uint32_t free = 0;
+
+    for (uint32_t i = 0; i < pmm_nodes[node].range_count; i++) {
+        struct pmm_range* r = &pmm_nodes[node].ranges[i];
+        for (uint32_t w = r->first; w < r->end; w++) {
+            free += 32 - popcount32(frame_bitmap[w]);
+        }
+    }
+    return free;
+}
+
+// Next-fit over bitmap words [first, end), starting at *hint
+static phys_addr_t pmm_take(uint32_t first, uint32_t end, uint32_t* hint) {
+    uint32_t w = *hint;
+
+    if (w < first || w >= end) w = first;
+    for (uint32_t n = first; n < end; n++, w++) {
+        if (w >= end) w = first;
+
+        if (frame_bitmap[w] != 0xFFFFFFFF) {
+            uint32_t pfn = w * 32 + __builtin_ctz(~frame_bitmap[w]);
+            if (pfn >= frame_count) continue;
+
+            frame_set(pfn);
+            free_frames--;
+            *hint = w;
+            return (phys_addr_t)pfn * PAGE_SIZE;
+        }
+    }
+    return 0;
+}
+
+// The node's words within [lo, hi)
+static phys_addr_t pmm_take_node(int node, uint32_t lo, uint32_t hi) {
+    struct pmm_node* n = &pmm_nodes[node];
+
+    for (uint32_t i = 0; i < n->range_count; i++) {
+        struct pmm_range* r = &n->ranges[i];
+        uint32_t first = r->first > lo ? r->first : lo;
+        uint32_t end = r->end < hi ? r->end : hi;
+        if (first >= end) continue;
+
+        phys_addr_t frame = pmm_take(first, end, &r->hint);
+        if (frame) return frame;
+    }
+    return 0;
+}
+
+// Nearest node first; the high zone only for callers that asked for it
+static phys_addr_t pmm_take_any(int node, int high) {
+    for (int i = 0; i < numa_node_count; i++) {
+        int from = numa_fallback[node][i];
+        phys_addr_t frame = 0;
+
+        if (high) frame = pmm_take_node(from, low_words, bitmap_words);
+        if (!frame) frame = pmm_take_node(from, 0, low_words);
+        if (frame) {
+            if (from == node) {
+                numa_stats[from].local++;
+            } else {
+                numa_stats[from].remote++;
+                numa_stats[node].foreign++;
+            }
+            return frame;
+        }
+    }
+    return 0;
+}
+
+// Below the min watermark the caller reclaims first; the reserve is only
+// handed out if that frees nothing
+static phys_addr_t pmm_alloc(int node, int high) {
+    phys_addr_t frame = 0;
+    unsigned long flags = irq_save();
+
+    if (free_frames > wmark_min) {
+        frame = pmm_take_any(node, high);
+    }
+    irq_restore(flags);
+
+    if (frame) {
+        if (free_frames < wmark_low) reclaim_wake();
+        return frame;
+    }
+
+    reclaim_direct();
+
+    flags = irq_save();
+    frame = pmm_take_any(node, high);
+    irq_restore(flags);
+
+    if (!frame) reclaim_stats.failed++;
+    return frame;
+}
+
+// Returns a directly mapped free frame, or 0 when memory is exhausted
+__hot phys_addr_t pmm_alloc_frame(void) {
+    return pmm_alloc(numa_node_id(), 0);
+}
+
+phys_addr_t pmm_alloc_frame_node(int node) {
+    return pmm_alloc(node, 0);
+}
+
+// For frames only ever touched through kmap(): prefers the high zone
+phys_addr_t pmm_alloc_frame_high(void) {
+    return pmm_alloc(numa_node_id(), 1);
+}
+
+__hot void pmm_free_frame(phys_addr_t frame) {
+    uint32_t pfn = (uint32_t)(frame / PAGE_SIZE);
+    unsigned long flags = irq_save();
+
+    if (pfn < frame_count && frame_test(pfn)) {
+        frame_clear(pfn);
+        free_frames++;
+    }
+    irq_restore(flags);
+}
+
+uint32_t pmm_free_count(void) {
+    return free_frames;
+}
+
+uint32_t pmm_total_count(void) {
+    return total_frames;
+}
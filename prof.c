@@ -0,0 +1,84 @@
+// prof.c - Sampling profiler
+//
+// While running, every timer tick looks up the interrupted pc in the kernel
+// symbol table and counts a hit against that function. "prof show" lists
+// the busiest functions, so profiles are read on the target with no host
+// tools. Raise the rate with "sysctl hz=1000" for finer profiles.
+
+#include "kernel.h"
+
+#define PROF_MAX_SYMBOLS 4096
+#define PROF_TOP 10
+
+static uint32_t prof_hits[PROF_MAX_SYMBOLS];
+static uint32_t prof_samples;
+static uint32_t prof_unknown;      // Outside kernel text, or past PROF_MAX_SYMBOLS
+static volatile int prof_running;
+
+// Timer interrupt context
+__hot void prof_sample(uintptr_t pc) {
+    int index;
+
+    if (!prof_running) return;
+    index = ksym_index(pc);
+    prof_samples++;
+    if (index < 0 || index >= PROF_MAX_SYMBOLS) {
+        prof_unknown++;
+    } else {
+        prof_hits[index]++;
+    }
+}
+
+void prof_start(void) {
+    unsigned long flags = irq_save();
+
+    for (int i = 0; i < PROF_MAX_SYMBOLS; i++) {
+        prof_hits[i] = 0;
+    }
+    prof_samples = 0;
+    prof_unknown = 0;
+    prof_running = 1;
+    irq_restore(flags);
+}
+
+void prof_stop(void) {
+    prof_running = 0;
+}
+
+void prof_report(void) {
+    int top[PROF_TOP];
+    int count = 0;
+
+    terminal_writestring("Samples: ");
+    terminal_writedec(prof_samples);
+    terminal_writestring(prof_running ? " (running)\n" : "\n");
+    if (!prof_samples) return;
+
+    // Insertion into a short list of the busiest symbols
+    for (int i = 0; i < PROF_MAX_SYMBOLS; i++) {
+        if (!prof_hits[i]) continue;
+        int pos = count < PROF_TOP ? count++ : PROF_TOP;
+        while (pos > 0 && prof_hits[top[pos - 1]] < prof_hits[i]) {
+            if (pos < PROF_TOP) top[pos] = top[pos - 1];
+            pos--;
+        }
+        if (pos < PROF_TOP) top[pos] = i;
+    }
+
+    for (int i = 0; i < count; i++) {
+        uint32_t percent = (uint32_t)div64_u32((uint64_t)prof_hits[top[i]] * 100, prof_samples);
+        terminal_writestring("  ");
+        if (percent < 10) terminal_putchar(' ');
+        terminal_writedec(percent);
+        terminal_writestring("%  ");
+        terminal_writedec(prof_hits[top[i]]);
+        terminal_writestring("  ");
+        terminal_writestring(ksym_name(top[i]));
+        terminal_putchar('\n');
+    }
+    if (prof_unknown) {
+        terminal_writestring("  Unresolved: ");
+        terminal_writedec(prof_unknown);
+        terminal_putchar('\n');
+    }
+}
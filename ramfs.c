@@ -0,0 +1,115 @@
+// ramfs.c - Files kept in memory
+//
+// A flat table of named files; names are whole paths such as "/tmp/out"
+// and there are no directories. File data lives in whole frames, listed
+// in order in the file, so appending never moves what is already written.
+// Threads only switch in schedule() and nothing here sleeps, so calls do
+// not interleave and no lock is taken.
+
+#include "kernel.h"
+
+#define RAMFS_MAX_FILES 32
+#define RAMFS_FILE_PAGES 64                 // 256 KiB per file
+
+struct ramfs_file {
+    char name[RAMFS_NAME_MAX];              // Empty while the slot is free
+    uint32_t size;
+    char* pages[RAMFS_FILE_PAGES];
+};
+
+static struct ramfs_file ramfs_files[RAMFS_MAX_FILES];
+
+struct ramfs_file* ramfs_lookup(const char* name) {
+    for (int i = 0; i < RAMFS_MAX_FILES; i++) {
+        if (ramfs_files[i].name[0] && str_cmp(ramfs_files[i].name, name) == 0) {
+            return &ramfs_files[i];
+        }
+    }
+    return 0;
+}
+
+// Returns the file, creating it empty if needed; 0 if the name is too long
+// or the table is full
+struct ramfs_file* ramfs_create(const char* name) {
+    struct ramfs_file* f = ramfs_lookup(name);
+
+    if (f) return f;
+    if (!*name || str_len(name) >= RAMFS_NAME_MAX) return 0;
+    for (int i = 0; i < RAMFS_MAX_FILES; i++) {
+        f = &ramfs_files[i];
+        if (f->name[0]) continue;
+        str_copy(f->name, name);
+        f->size = 0;
+        return f;
+    }
+    return 0;
+}
+
+void ramfs_truncate(struct ramfs_file* f) {
+    for (uint32_t i = 0; i < RAMFS_FILE_PAGES && f->pages[i]; i++) {
+        pmm_free_frame(virt_to_phys(f->pages[i]));
+        f->pages[i] = 0;
+    }
+    f->size = 0;
+}
+
+int ramfs_unlink(const char* name) {
+    struct ramfs_file* f = ramfs_lookup(name);
+
+    if (!f) return 0;
+    ramfs_truncate(f);
+    f->name[0] = '\0';
+    return 1;
+}
+
+uint32_t ramfs_size(const struct ramfs_file* f) {
+    return f->size;
+}
+
+// Appends; returns how much fit before the file or memory ran out
+uint32_t ramfs_write(struct ramfs_file* f, const char* data, uint32_t len) {
+    uint32_t done = 0;
+
+    while (done < len) {
+        uint32_t page = f->size / PAGE_SIZE;
+        uint32_t offset = f->size % PAGE_SIZE;
+
+        if (page == RAMFS_FILE_PAGES) break;
+        if (!f->pages[page]) {
+            phys_addr_t frame = pmm_alloc_frame();
+            if (!frame) break;
+            f->pages[page] = phys_to_virt(frame);
+        }
+        while (done < len && offset < PAGE_SIZE) {
+            f->pages[page][offset++] = data[done++];
+        }
+        f->size = page * PAGE_SIZE + offset;
+    }
+    return done;
+}
+
+uint32_t ramfs_read(const struct ramfs_file* f, uint32_t pos, char* data, uint32_t len) {
+    uint32_t done = 0;
+
+    while (done < len && pos < f->size) {
+        data[done++] = f->pages[pos / PAGE_SIZE][pos % PAGE_SIZE];
+        pos++;
+    }
+    return done;
+}
+
+void ramfs_report(void) {
+    terminal_writestring("size     name\n");
+    for (int i = 0; i < RAMFS_MAX_FILES; i++) {
+        struct ramfs_file* f = &ramfs_files[i];
+
+        uint32_t digits = 1;
+
+        if (!f->name[0]) continue;
+        for (uint32_t v = f->size; v >= 10; v /= 10) digits++;
+        terminal_writedec(f->size);
+        for (; digits < 9; digits++) terminal_putchar(' ');
+        terminal_writestring(f->name);
+        terminal_putchar('\n');
+    }
+}
@@ -0,0 +1,148 @@
+// rcu.c - Quiescent-state based read-copy-update
+//
+// A grace period ends once every online CPU has passed a quiescent state
+// after it began: a trip through schedule() or the idle loop outside any
+// read section. Since threads never switch inside a read section, no
+// reader that could see the old data is still running by then.
+//
+// call_rcu() callbacks wait on their CPU's next list. When no grace period
+// is running, the next list becomes the wait list and a new period starts.
+// When the period ends, the wait list becomes the done list, and the RCU
+// softirq runs it with interrupts enabled.
+
+#include "kernel.h"
+
+struct rcu_cpu {
+    struct rcu_head* next_list;         // Not yet waiting on a grace period
+    struct rcu_head** next_tail;        // 0 while next_list is empty
+    struct rcu_head* wait_list;         // Waiting on the current one
+    struct rcu_head* done_list;         // Ready to run
+    int qs_pending;                     // Must still pass a quiescent state
+} __attribute__((aligned(64)));
+
+struct rcu_reader rcu_readers[NR_CPUS];
+static struct rcu_cpu rcu_cpus[NR_CPUS];
+
+// Only the boot CPU is online
+static uint32_t rcu_online_mask = 1;
+static uint32_t rcu_qs_mask;            // CPUs the current period waits for
+static int rcu_gp_running;
+static uint32_t rcu_gp_completed;
+static uint32_t rcu_callbacks_run;
+
+struct rcu_sync {
+    struct rcu_head head;
+    volatile int done;
+    struct wait_queue wait;
+};
+
+// Interrupts off. Every CPU's next list moves to its wait list.
+static void rcu_start_gp(void) {
+    for (int cpu = 0; cpu < NR_CPUS; cpu++) {
+        struct rcu_cpu* rc = &rcu_cpus[cpu];
+
+        if (!(rcu_online_mask & (1u << cpu))) continue;
+        rc->wait_list = rc->next_list;
+        rc->next_list = 0;
+        rc->next_tail = 0;
+        rc->qs_pending = 1;
+    }
+    rcu_qs_mask = rcu_online_mask;
+    rcu_gp_running = 1;
+}
+
+static void rcu_end_gp(void) {
+    int more = 0;
+
+    for (int cpu = 0; cpu < NR_CPUS; cpu++) {
+        struct rcu_cpu* rc = &rcu_cpus[cpu];
+        struct rcu_head** tail = &rc->done_list;
+
+        while (*tail) tail = &(*tail)->next;
+        *tail = rc->wait_list;
+        rc->wait_list = 0;
+        if (rc->next_list) more = 1;
+    }
+    rcu_gp_running = 0;
+    rcu_gp_completed++;
+    raise_softirq(SOFTIRQ_RCU);
+    if (more) rcu_start_gp();
+}
+
+// Called from schedule() and the idle loop
+void rcu_note_qs(void) {
+    unsigned long flags = irq_save();
+    uint32_t cpu = cpu_id();
+    struct rcu_cpu* rc = &rcu_cpus[cpu];
+
+    if (rc->qs_pending && !rcu_readers[cpu].nesting) {
+        rc->qs_pending = 0;
+        rcu_qs_mask &= ~(1u << cpu);
+        if (!rcu_qs_mask) rcu_end_gp();
+    }
+    irq_restore(flags);
+}
+
+// Safe from any context; func runs from the RCU softirq after a grace period
+void call_rcu(struct rcu_head* head, void (*func)(struct rcu_head*)) {
+    unsigned long flags = irq_save();
+    struct rcu_cpu* rc = &rcu_cpus[cpu_id()];
+
+    head->func = func;
+    head->next = 0;
+    if (rc->next_tail) *rc->next_tail = head;
+    else rc->next_list = head;
+    rc->next_tail = &head->next;
+    if (!rcu_gp_running) rcu_start_gp();
+    irq_restore(flags);
+}
+
+void rcu_process_callbacks(void) {
+    unsigned long flags = irq_save();
+    struct rcu_cpu* rc = &rcu_cpus[cpu_id()];
+    struct rcu_head* list = rc->done_list;
+
+    rc->done_list = 0;
+    irq_restore(flags);
+
+    while (list) {
+        struct rcu_head* head = list;
+        list = head->next;
+        head->func(head);
+        rcu_callbacks_run++;
+    }
+}
+
+static void rcu_sync_done(struct rcu_head* head) {
+    struct rcu_sync* sync = container_of(head, struct rcu_sync, head);
+
+    sync->done = 1;
+    wake_up(&sync->wait);
+}
+
+// Sleeps until every reader that might hold an old pointer has finished.
+// Thread context, outside any read section.
+void synchronize_rcu(void) {
+    struct rcu_sync sync;
+
+    sync.done = 0;
+    wait_queue_init(&sync.wait);
+    call_rcu(&sync.head, rcu_sync_done);
+    wait_event(&sync.wait, sync.done);
+}
+
+void rcu_report(void) {
+    uint32_t waiting = 0;
+
+    for (int cpu = 0; cpu < NR_CPUS; cpu++) {
+        for (struct rcu_head* h = rcu_cpus[cpu].next_list; h; h = h->next) waiting++;
+        for (struct rcu_head* h = rcu_cpus[cpu].wait_list; h; h = h->next) waiting++;
+    }
+    terminal_writestring("RCU: ");
+    terminal_writedec(rcu_gp_completed);
+    terminal_writestring(" grace periods, ");
+    terminal_writedec(rcu_callbacks_run);
+    terminal_writestring(" callbacks run, ");
+    terminal_writedec(waiting);
+    terminal_writestring(rcu_gp_running ? " waiting (period running)\n" : " waiting\n");
+}
@@ -0,0 +1,194 @@
+// reclaim.c - Watermark-driven memory reclaim
+//
+// Caches that can give memory back register a shrinker: count() reports how
+// many objects could be freed, scan(n) tries to free up to n and returns how
+// many went. The frame allocator checks three watermarks:
+//
+//   free < low   wake background reclaim, which runs until free >= high
+//   free < min   the allocating caller reclaims directly before taking one
+//                of the reserved frames
+//
+// Background reclaim runs in the kreclaimd thread.
+
+#include "kernel.h"
+
+// Shrinkers listed by reclaim_report()
+#define REPORT_SHRINKERS 16
+
+// Scan passes go from count >> 12 up to the whole count per shrinker
+#define RECLAIM_PRIORITY_MAX 12
+
+static struct shrinker* shrinkers = 0;
+static spinlock_t shrinker_lock;
+static volatile int reclaim_pending = 0;
+static volatile int reclaim_running = 0;
+static struct thread* reclaim_thread = 0;
+
+uint32_t min_free_kbytes = 0;           // 0 = derive from memory size
+uint32_t wmark_min = 0;
+uint32_t wmark_low = 0;
+uint32_t wmark_high = 0;
+struct reclaim_stats reclaim_stats;
+
+// The shrinker list is read under RCU, so reclaim never takes a lock to
+// walk it
+void register_shrinker(struct shrinker* s) {
+    unsigned long flags = spin_lock_irqsave(&shrinker_lock);
+    s->next = shrinkers;
+    rcu_assign_pointer(shrinkers, s);
+    spin_unlock_irqrestore(&shrinker_lock, flags);
+}
+
+// Once this returns no reclaim pass can still be calling s
+void unregister_shrinker(struct shrinker* s) {
+    unsigned long flags = spin_lock_irqsave(&shrinker_lock);
+    for (struct shrinker** link = &shrinkers; *link; link = &(*link)->next) {
+        if (*link == s) {
+            rcu_assign_pointer(*link, s->next);
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&shrinker_lock, flags);
+    synchronize_rcu();
+}
+
+// min is about 1/128 of memory (at least 64 KiB), low and high 25% and
+// 50% above it
+void reclaim_set_watermarks(void) {
+    uint32_t min = min_free_kbytes / (PAGE_SIZE / 1024);
+
+    if (!min_free_kbytes) {
+        min = pmm_total_count() / 128;
+        if (min < 16) min = 16;
+    }
+    wmark_min = min;
+    wmark_low = min + min / 4;
+    wmark_high = min + min / 2;
+}
+
+KPARAM_INT(min_free_kb, min_free_kbytes, 0, 1048576, reclaim_set_watermarks,
+           "Reserved memory in KB (0 = auto); sets the reclaim watermarks");
+
+// Returns frames gained. Shrinkers may not sleep and must skip (not spin
+// on) locks the interrupted allocator could be holding.
+static uint32_t shrink_all(uint32_t target) {
+    uint32_t start = pmm_free_count();
+
+    if (__atomic_exchange_n(&reclaim_running, 1, __ATOMIC_ACQUIRE)) return 0;
+
+    rcu_read_lock();
+    for (int priority = RECLAIM_PRIORITY_MAX; priority >= 0; priority--) {
+        for (struct shrinker* s = rcu_dereference(shrinkers); s; s = rcu_dereference(s->next)) {
+            uint32_t count = s->count();
+            uint32_t scan = count >> priority;
+            if (!scan) scan = count < 8 ? count : 8;
+            if (!scan) continue;
+
+            uint32_t freed = s->scan(scan);
+            s->freed += freed;
+            reclaim_stats.scanned += scan;
+            reclaim_stats.freed_objects += freed;
+        }
+        if (pmm_free_count() >= start + target) break;
+    }
+    rcu_read_unlock();
+
+    __atomic_store_n(&reclaim_running, 0, __ATOMIC_RELEASE);
+
+    uint32_t gained = pmm_free_count() > start ? pmm_free_count() - start : 0;
+    reclaim_stats.freed_frames += gained;
+    return gained;
+}
+
+void reclaim_wake(void) {
+    if (!reclaim_pending) {
+        reclaim_pending = 1;
+        reclaim_stats.wakeups++;
+        if (reclaim_thread) thread_wake(reclaim_thread);
+    }
+}
+
+// Called by the allocator once free frames fall to the min watermark
+uint32_t reclaim_direct(void) {
+    uint32_t free = pmm_free_count();
+
+    reclaim_stats.direct++;
+    return shrink_all(free < wmark_high ? wmark_high - free : 1);
+}
+
+static void reclaim_loop(void* arg) {
+    (void)arg;
+    while (1) {
+        unsigned long flags = irq_save();
+        if (!reclaim_pending) thread_block();
+        reclaim_pending = 0;
+        irq_restore(flags);
+
+        uint32_t free = pmm_free_count();
+        if (free < wmark_high) {
+            reclaim_stats.background++;
+            shrink_all(wmark_high - free);
+        }
+    }
+}
+
+__cold void reclaim_start(void) {
+    reclaim_thread = thread_create("kreclaimd", reclaim_loop, 0);
+}
+
+void reclaim_report(void) {
+    terminal_writestring("Watermarks (frames): min ");
+    terminal_writedec(wmark_min);
+    terminal_writestring(", low ");
+    terminal_writedec(wmark_low);
+    terminal_writestring(", high ");
+    terminal_writedec(wmark_high);
+    terminal_writestring("\nReclaim: ");
+    terminal_writedec(reclaim_stats.wakeups);
+    terminal_writestring(" wakeups, ");
+    terminal_writedec(reclaim_stats.background);
+    terminal_writestring(" background, ");
+    terminal_writedec(reclaim_stats.direct);
+    terminal_writestring(" direct, ");
+    terminal_writedec(reclaim_stats.failed);
+    terminal_writestring(" failed allocations\n  scanned ");
+    terminal_writedec(reclaim_stats.scanned);
+    terminal_writestring(", freed ");
+    terminal_writedec(reclaim_stats.freed_objects);
+    terminal_writestring(" objects and ");
+    terminal_writedec(reclaim_stats.freed_frames);
+    terminal_writestring(" frames\n");
+
+    // Output may go to a pipe and sleep, which a read section must not,
+    // so the list is copied first and printed afterwards
+    struct { const char* name; uint32_t count, freed; } seen[REPORT_SHRINKERS];
+    int n = 0, more = 0;
+
+    rcu_read_lock();
+    for (struct shrinker* s = rcu_dereference(shrinkers); s; s = rcu_dereference(s->next)) {
+        if (n == REPORT_SHRINKERS) {
+            more++;
+            continue;
+        }
+        seen[n].name = s->name;
+        seen[n].count = s->count();
+        seen[n].freed = s->freed;
+        n++;
+    }
+    rcu_read_unlock();
+
+    for (int i = 0; i < n; i++) {
+        terminal_writestring("  ");
+        terminal_writestring(seen[i].name);
+        terminal_writestring(": ");
+        terminal_writedec(seen[i].count);
+        terminal_writestring(" reclaimable, ");
+        terminal_writedec(seen[i].freed);
+        terminal_writestring(" freed\n");
+    }
+    if (more) {
+        terminal_writestring("  (");
+        terminal_writedec(more);
+        terminal_writestring(" more)\n");
+    }
+}
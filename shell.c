@@ -0,0 +1,1680 @@
+// shell.c - Interactive shell and its built-in commands
+
+#include "kernel.h"
+
+static uint32_t bench_iterations = 1000;
+static uint32_t selftest_failures = 0;
+static volatile uint32_t selftest_thread_runs = 0;
+static volatile uint32_t selftest_thread_exits = 0;
+
+static volatile uint32_t selftest_tasklet_runs = 0;
+
+static void selftest_tasklet(void* arg) {
+    (void)arg;
+    selftest_tasklet_runs++;
+}
+
+static void selftest_work(void* arg) {
+    (*(volatile uint32_t*)arg)++;
+}
+
+struct selftest_rcu_node {
+    struct rcu_hnode node;
+    uint32_t key;
+    struct rcu_head rcu;
+};
+
+static volatile uint32_t selftest_rcu_freed = 0;
+
+static void selftest_rcu_free(struct rcu_head* head) {
+    (void)head;
+    selftest_rcu_freed++;
+}
+
+static int selftest_rcu_find(struct rcu_hlist* table, uint32_t key) {
+    struct rcu_hnode* pos;
+    int found = 0;
+
+    rcu_read_lock();
+    rcu_hlist_for_each(pos, &table[key % 4]) {
+        if (container_of(pos, struct selftest_rcu_node, node)->key == key) found = 1;
+    }
+    rcu_read_unlock();
+    return found;
+}
+
+static struct mutex selftest_mutex;
+
+static void selftest_mutex_thread(void* arg) {
+    (void)arg;
+    mutex_lock(&selftest_mutex);
+    selftest_thread_runs++;
+    mutex_unlock(&selftest_mutex);
+    selftest_thread_exits++;
+}
+
+static struct fmutex selftest_fmutex;
+static struct fcond selftest_fcond;
+static volatile uint32_t selftest_fcond_ready = 0;
+
+static void selftest_fmutex_thread(void* arg) {
+    (void)arg;
+    fmutex_lock(&selftest_fmutex);
+    selftest_thread_runs++;
+    selftest_fcond_ready = 1;
+    fcond_signal(&selftest_fcond);
+    fmutex_unlock(&selftest_fmutex);
+    selftest_thread_exits++;
+}
+
+static void selftest_thread(void* arg) {
+    selftest_thread_runs += (uint32_t)(uintptr_t)arg;
+    selftest_thread_exits++;
+}
+
+// Echoes each message on chans[0] back on chans[1]; an empty one ends it
+static void selftest_chan_echo(void* arg) {
+    struct chan** chans = arg;
+    uint32_t len;
+
+    do {
+        struct chan_slot* in = chan_peek_wait(chans[0]);
+        struct chan_slot* out = chan_reserve_wait(chans[1]);
+        len = in->len;
+        out->data[0] = in->data[0];
+        chan_consume(chans[0]);
+        chan_publish(chans[1], len);
+    } while (len);
+    selftest_thread_exits++;
+}
+
+// Round trips through an echo thread, then an empty message to stop it.
+// Returns how many replies came back intact.
+static uint32_t chan_pingpong(struct chan** chans, uint32_t rounds) {
+    uint32_t exits = selftest_thread_exits;
+    uint32_t intact = 0;
+
+    if (!thread_create("chan-echo", selftest_chan_echo, chans)) return 0;
+    for (uint32_t i = 0; i <= rounds; i++) {
+        struct chan_slot* out = chan_reserve_wait(chans[0]);
+        out->data[0] = (char)i;
+        chan_publish(chans[0], i < rounds ? 1 : 0);
+
+        struct chan_slot* in = chan_peek_wait(chans[1]);
+        if (in->data[0] == (char)i) intact++;
+        chan_consume(chans[1]);
+    }
+    while (selftest_thread_exits == exits) {
+        thread_yield();
+    }
+    return intact;
+}
+
+// Spawn a thread and yield until it has run. Threads only give up the CPU
+// by yielding or exiting, so by then it has exited.
+static int spawn_and_wait(uint32_t add) {
+    uint32_t exits = selftest_thread_exits;
+
+    if (!thread_create("selftest", selftest_thread, (void*)(uintptr_t)add)) return 0;
+    while (selftest_thread_exits == exits) {
+        thread_yield();
+    }
+    return 1;
+}
+
+// Shell commands
+void cmd_help() {
+    terminal_setcolor(make_color(YELLOW, BLACK));
+    terminal_writestring("Available commands:\n");
+    terminal_setcolor(make_color(WHITE, BLACK));
+    terminal_writestring("  help      - Show this help message\n");
+    terminal_writestring("  clear     - Clear the screen\n");
+    terminal_writestring("  echo      - Echo text back\n");
+    terminal_writestring("  time      - Show uptime, or time a command (time <command>)\n");
+    terminal_writestring("  sysinfo   - Show system information\n");
+    terminal_writestring("  meminfo   - Show memory, reclaim counters and direct map\n");
+    terminal_writestring("  slabinfo  - Show object caches and magazine hit rates\n");
+    terminal_writestring("  numastat  - Show per-node free memory and allocations\n");
+    terminal_writestring("  threads   - List kernel threads and stack pool usage\n");
+    terminal_writestring("  softirqs  - Show deferred interrupt work counters\n");
+    terminal_writestring("  workqueues - Show workqueues and their workers\n");
+    terminal_writestring("  rcu       - Show RCU grace periods and callbacks\n");
+    terminal_writestring("  bg        - Run a command on a worker thread (bg <command>)\n");
+    terminal_writestring("  crash     - Fault on purpose to check the dump (crash [stack])\n");
+    terminal_writestring("  backtrace - Show the shell's call stack\n");
+    terminal_writestring("  prof      - Sample the kernel on timer ticks (prof start|stop|show)\n");
+    terminal_writestring("  colors    - Display all VGA colors\n");
+    terminal_writestring("  box       - Draw a colored box\n");
+    terminal_writestring("  banner    - Show kernel banner\n");
+    terminal_writestring("  selftest  - Run kernel self-tests\n");
+    terminal_writestring("  bench     - Benchmark kernel hot paths\n");
+    terminal_writestring("  exit      - Exit QEMU with a status code\n");
+    terminal_writestring("  sysctl    - Show or set kernel parameters\n");
+    terminal_writestring("  grep      - Keep lines containing text (cmd | grep <text>)\n");
+    terminal_writestring("  wc        - Count lines, words and bytes (cmd | wc)\n");
+    terminal_writestring("  head      - Keep the first lines (cmd | head [count])\n");
+    terminal_writestring("  ls        - List files in the ramfs\n");
+    terminal_writestring("  cat       - Show a ramfs file (cat <file>)\n");
+    terminal_writestring("  rm        - Remove a ramfs file (rm <file>)\n");
+    terminal_writestring("  set       - Show or set shell variables (set name value)\n");
+    terminal_writestring("  run       - Run a ramfs file as a script (run <file>)\n");
+#ifdef KERNEL_GCOV
+    terminal_writestring("  gcov      - Export profile counters on COM1\n");
+#endif
+    terminal_writestring("  shutdown  - Halt the system\n");
+    terminal_writestring("Commands joined with | run together, each one's output\n");
+    terminal_writestring("feeding the next through a pipe. cmd > file and cmd >> file\n");
+    terminal_writestring("save output in the ramfs; /dev/null, /dev/serial and\n");
+    terminal_writestring("/dev/console name devices instead. $name expands a variable.\n");
+    terminal_writestring("Scripts may loop with repeat <count> [name] ... end.\n");
+}
+
+void cmd_echo(const char* args) {
+    terminal_writestring(args);
+    terminal_putchar('\n');
+}
+
+void cmd_time() {
+    terminal_writestring("System uptime: ");
+    terminal_writedec(uptime_ms() / 1000);
+    terminal_writestring(" seconds\n");
+}
+
+void cmd_sysinfo() {
+    terminal_setcolor(make_color(LIGHT_CYAN, BLACK));
+    terminal_writestring("System Information:\n");
+    terminal_setcolor(make_color(WHITE, BLACK));
+    terminal_writestring("  Kernel: SimpleOS v1.0\n");
+#ifdef __x86_64__
+    terminal_writestring("  Architecture: x86-64 (long mode)\n");
+#else
+    terminal_writestring("  Architecture: x86 (32-bit)\n");
+#endif
+    terminal_writestring("  Display: VGA Text Mode (80x25)\n");
+    terminal_writestring("  Command line: ");
+    terminal_writestring(kernel_cmdline);
+    terminal_putchar('\n');
+    terminal_writestring("  Modules: ");
+    terminal_writedec(boot_info && (boot_info->flags & MULTIBOOT_INFO_MODS) ? boot_info->mods_count : 0);
+    terminal_putchar('\n');
+    terminal_writestring("  Serial: ");
+    terminal_writestring(serial_present ? "COM1 (115200 8N1)\n" : "not present\n");
+    terminal_writestring("  Timer ticks: ");
+    terminal_writedec(timer_ticks);
+    terminal_putchar('\n');
+    terminal_writestring("  TSC: ");
+    if (tsc_khz) {
+        terminal_writedec(tsc_khz / 1000);
+        terminal_writestring(" MHz\n");
+    } else {
+        terminal_writestring("not used (tick-based time)\n");
+    }
+    terminal_writestring("  vDSO: ");
+    if (vdso_mapped) {
+        terminal_writehex(VDSO_BASE);
+        terminal_putchar('\n');
+    } else {
+        terminal_writestring("not mapped\n");
+    }
+}
+
+void cmd_meminfo() {
+    terminal_writestring("Frames: ");
+    terminal_writedec(pmm_free_count());
+    terminal_writestring(" free of ");
+    terminal_writedec(pmm_total_count());
+    terminal_writestring(" (");
+    terminal_writedec(pmm_free_count() / (1024 * 1024 / PAGE_SIZE));
+    terminal_writestring(" MB free)\n");
+    reclaim_report();
+    paging_report();
+}
+
+// Each level pins half a KiB of stack, so this reaches the guard page long
+// before the depth check
+static __attribute__((noinline)) uint32_t crash_recurse(uint32_t depth) {
+    volatile char pad[512];
+
+    pad[0] = (char)depth;
+    if (depth > 1000000) return 0;
+    return crash_recurse(depth + 1) + pad[0];
+}
+
+void cmd_crash(const char* args) {
+    if (str_cmp(args, "stack") == 0) {
+        terminal_writedec(crash_recurse(0));
+    }
+    // The guard page below the first pooled stack is never mapped
+    *(volatile uint32_t*)KSTACK_REGION_BASE = 0;
+}
+
+struct bg_command {
+    struct work work;
+    char line[256];
+};
+
+static void bg_run(void* arg) {
+    struct bg_command* bg = arg;
+
+    shell_execute(bg->line);
+    kfree(bg);
+}
+
+void cmd_bg(const char* args) {
+    struct bg_command* bg;
+
+    if (!*args) {
+        terminal_writestring("Usage: bg <command>\n");
+        return;
+    }
+    bg = system_wq ? kmalloc(sizeof(*bg)) : 0;
+    if (!bg) {
+        terminal_writestring("No worker threads\n");
+        return;
+    }
+    str_copy(bg->line, args);
+    work_init(&bg->work, bg_run, bg);
+    queue_work(system_wq, &bg->work);
+}
+
+void cmd_backtrace() {
+    backtrace_print((uintptr_t)cmd_backtrace, (uintptr_t)__builtin_frame_address(0));
+}
+
+void cmd_prof(const char* args) {
+    if (str_cmp(args, "start") == 0) {
+        prof_start();
+        terminal_writestring("Profiling started\n");
+    } else if (str_cmp(args, "stop") == 0) {
+        prof_stop();
+        prof_report();
+    } else if (str_cmp(args, "show") == 0 || args[0] == '\0') {
+        prof_report();
+    } else {
+        terminal_writestring("Usage: prof start|stop|show\n");
+    }
+}
+
+void cmd_colors() {
+    terminal_writestring("VGA Color Palette:\n");
+    for (int i = 0; i < 16; i++) {
+        terminal_setcolor(make_color(i, BLACK));
+        terminal_writestring("Color ");
+        terminal_writedec(i);
+        terminal_writestring("  ");
+    }
+    terminal_putchar('\n');
+    terminal_setcolor(make_color(LIGHT_GREEN, BLACK));
+}
+
+void cmd_box() {
+    int x = 10, y = 10, w = 20, h = 5;
+    draw_box(x, y, w, h, make_color(WHITE, BLUE));
+    terminal_setpos(y + h + 1, 0);
+    terminal_writestring("Drew a box at (10, 10) with size 20x5\n");
+}
+
+void cmd_banner() {
+    terminal_initialize();
+    terminal_setcolor(make_color(LIGHT_CYAN, BLACK));
+    terminal_writestring("========================================\n");
+    terminal_setcolor(make_color(YELLOW, BLACK));
+    terminal_writestring("   SimpleOS Kernel v1.0\n");
+    terminal_setcolor(make_color(LIGHT_CYAN, BLACK));
+    terminal_writestring("========================================\n");
+    terminal_setcolor(make_color(LIGHT_GREEN, BLACK));
+    terminal_writestring("Enhanced Interactive Kernel\n\n");
+}
+
+// Shell variables: "set NAME value", expanded as $NAME in every line
+// typed or read from a script. \$ stands for a literal dollar sign.
+#define SHELL_VARS_MAX 16
+#define SHELL_VAR_NAME_MAX 16
+#define SHELL_VAR_VALUE_MAX 64
+
+struct shell_var {
+    char name[SHELL_VAR_NAME_MAX];      // Empty while the slot is free
+    char value[SHELL_VAR_VALUE_MAX];
+};
+
+static struct shell_var shell_vars[SHELL_VARS_MAX];
+static int script_echo = 1;
+
+KPARAM_BOOL(script_echo, script_echo, 0, "Show script lines before running them");
+
+static int var_name_char(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+static struct shell_var* shell_var_find(const char* name, int len) {
+    for (int i = 0; i < SHELL_VARS_MAX; i++) {
+        struct shell_var* v = &shell_vars[i];
+        int k = 0;
+
+        if (!v->name[0]) continue;
+        while (k < len && v->name[k] == name[k]) k++;
+        if (k == len && !v->name[k]) return v;
+    }
+    return 0;
+}
+
+// An empty value removes the variable. Returns 0 if the name is invalid
+// or there is no room.
+static int shell_var_set(const char* name, const char* value) {
+    int len = str_len(name);
+    struct shell_var* v = shell_var_find(name, len);
+
+    if (!len || len >= SHELL_VAR_NAME_MAX) return 0;
+    for (int i = 0; i < len; i++) {
+        if (!var_name_char(name[i])) return 0;
+    }
+    if (!*value) {
+        if (v) v->name[0] = '\0';
+        return 1;
+    }
+    for (int i = 0; !v && i < SHELL_VARS_MAX; i++) {
+        if (!shell_vars[i].name[0]) v = &shell_vars[i];
+    }
+    if (!v) return 0;
+    str_copy(v->name, name);
+    for (len = 0; value[len] && len < SHELL_VAR_VALUE_MAX - 1; len++) v->value[len] = value[len];
+    v->value[len] = '\0';
+    return 1;
+}
+
+// Unknown variables expand to nothing; output is cut at max - 1 chars
+static void shell_expand(const char* in, char* out, int max) {
+    int len = 0;
+
+    while (*in && len < max - 1) {
+        if (in[0] == '\\' && in[1] == '$') {
+            out[len++] = '$';
+            in += 2;
+        } else if (in[0] == '$' && var_name_char(in[1])) {
+            int name_len = 1;
+            while (var_name_char(in[1 + name_len])) name_len++;
+            struct shell_var* v = shell_var_find(in + 1, name_len);
+            for (const char* val = v ? v->value : ""; *val && len < max - 1; val++) {
+                out[len++] = *val;
+            }
+            in += 1 + name_len;
+        } else {
+            out[len++] = *in++;
+        }
+    }
+    out[len] = '\0';
+}
+
+static void uint_to_str(uint32_t value, char* out) {
+    char digits[12];
+    int n = 0;
+
+    do {
+        digits[n++] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    while (n) *out++ = digits[--n];
+    *out = '\0';
+}
+
+// The text after word if line starts with it as a whole word, else 0
+static const char* str_word(const char* line, const char* word) {
+    while (*word && *line == *word) {
+        line++;
+        word++;
+    }
+    if (*word || (*line && *line != ' ')) return 0;
+    while (*line == ' ') line++;
+    return line;
+}
+
+void cmd_set(const char* args) {
+    char name[SHELL_VAR_NAME_MAX + 1];
+    int len = 0;
+
+    if (!*args) {
+        for (int i = 0; i < SHELL_VARS_MAX; i++) {
+            if (!shell_vars[i].name[0]) continue;
+            terminal_writestring(shell_vars[i].name);
+            terminal_putchar('=');
+            terminal_writestring(shell_vars[i].value);
+            terminal_putchar('\n');
+        }
+        return;
+    }
+    while (*args && *args != ' ' && len < SHELL_VAR_NAME_MAX) name[len++] = *args++;
+    name[len] = '\0';
+    while (*args == ' ') args++;
+    if (!shell_var_set(name, args)) {
+        terminal_writestring("Usage: set [name [value]]\n");
+    }
+}
+
+// time <command>: how long the whole line took, pipes and redirection
+// included
+static void shell_time(const char* line) {
+    uint64_t start = ktime_ns();
+    uint32_t us;
+
+    shell_execute(line);
+    us = (uint32_t)div64_u32(ktime_ns() - start, 1000);
+    terminal_writestring("time: ");
+    terminal_writedec(us / 1000);
+    terminal_putchar('.');
+    for (uint32_t place = 100; place > 1 && us % 1000 < place; place /= 10) terminal_putchar('0');
+    terminal_writedec(us % 1000);
+    terminal_writestring(" ms\n");
+}
+
+// Scripts: a module in memory or a ramfs file, run line by line. Besides
+// shell commands they may hold "repeat <count> [name]" ... "end" blocks,
+// which run their body count times with $name set to 1, 2, ... Blocks
+// nest, and are re-read from the source on every pass, so variables are
+// expanded afresh each time.
+#define SCRIPT_LOOP_DEPTH 4
+#define SCRIPT_NEST_MAX 4
+
+struct script_loop {
+    uint32_t start;                     // Where the body begins
+    uint32_t left;                      // Passes after the current one
+    uint32_t iter;
+    char var[SHELL_VAR_NAME_MAX];
+};
+
+struct script {
+    const char* text;                   // Module text, or
+    const struct ramfs_file* file;      // a ramfs file
+    uint32_t size;                      // Of text
+    uint32_t pos;
+    int depth;
+    struct script_loop loops[SCRIPT_LOOP_DEPTH];
+};
+
+static int script_nesting = 0;
+
+static int script_getc(struct script* s, char* c) {
+    if (s->file) return ramfs_read(s->file, s->pos++, c, 1) == 1;
+    if (s->pos >= s->size) return 0;
+    *c = s->text[s->pos++];
+    if (*c) return 1;
+    s->size = s->pos;                   // A NUL ends the text
+    return 0;
+}
+
+// The next line without leading blanks, '\r' or the newline; -1 at the end
+static int script_read_line(struct script* s, char* line, int max) {
+    int len = 0, got;
+    char c = 0;
+
+    while ((got = script_getc(s, &c)) && c != '\n') {
+        if (c == '\r' || ((c == ' ' || c == '\t') && !len)) continue;
+        if (len < max - 1) line[len++] = c;
+    }
+    line[len] = '\0';
+    return (got || len) ? len : -1;
+}
+
+// After a "repeat 0": skip to the matching end
+static int script_skip_block(struct script* s) {
+    char line[256];
+    int nest = 1;
+
+    while (script_read_line(s, line, sizeof(line)) >= 0) {
+        if (str_word(line, "repeat")) nest++;
+        else if (str_word(line, "end") && --nest == 0) return 1;
+    }
+    return 0;
+}
+
+static void script_loop_var(struct script_loop* loop) {
+    char num[12];
+
+    if (!loop->var[0]) return;
+    uint_to_str(loop->iter, num);
+    shell_var_set(loop->var, num);
+}
+
+// Returns 0 if the script stopped on an error
+static int script_run(struct script* s) {
+    char line[256];
+    char expanded[256];
+    const char* rest;
+    const char* error = 0;
+
+    if (script_nesting == SCRIPT_NEST_MAX) {
+        terminal_writestring("Scripts nested too deeply\n");
+        return 0;
+    }
+    script_nesting++;
+
+    while (!error && script_read_line(s, line, sizeof(line)) >= 0) {
+        // Threads only switch when one gives up the CPU; a long script
+        // under bg would otherwise keep the console from taking input
+        thread_yield();
+
+        // Blank lines and '#' comments are skipped
+        if (!line[0] || line[0] == '#') continue;
+        shell_expand(line, expanded, sizeof(expanded));
+        if (script_echo) {
+            terminal_setcolor(make_color(LIGHT_BLUE, BLACK));
+            terminal_writestring("shell> ");
+            terminal_setcolor(make_color(WHITE, BLACK));
+            terminal_writestring(expanded);
+            terminal_putchar('\n');
+        }
+
+        if ((rest = str_word(expanded, "repeat"))) {
+            struct script_loop* loop = &s->loops[s->depth];
+            char count[12];
+            uint32_t n = 0;
+            int len = 0;
+
+            while (*rest && *rest != ' ' && len < 11) count[len++] = *rest++;
+            count[len] = '\0';
+            while (*rest == ' ') rest++;
+            if (s->depth == SCRIPT_LOOP_DEPTH) {
+                error = "Loops nested too deeply\n";
+            } else if (!str_to_uint(count, &n) || str_len(rest) >= SHELL_VAR_NAME_MAX) {
+                error = "Usage: repeat <count> [name] ... end\n";
+            } else if (!n) {
+                if (!script_skip_block(s)) error = "repeat without end\n";
+            } else {
+                loop->start = s->pos;
+                loop->left = n - 1;
+                loop->iter = 1;
+                str_copy(loop->var, rest);
+                script_loop_var(loop);
+                s->depth++;
+            }
+        } else if (str_word(expanded, "end")) {
+            struct script_loop* loop = s->depth ? &s->loops[s->depth - 1] : 0;
+
+            if (!loop) {
+                error = "end without repeat\n";
+            } else if (loop->left) {
+                loop->left--;
+                loop->iter++;
+                script_loop_var(loop);
+                s->pos = loop->start;
+            } else {
+                s->depth--;
+            }
+        } else {
+            shell_execute(expanded);
+        }
+    }
+    if (!error && s->depth) error = "repeat without end\n";
+    if (error) terminal_writestring(error);
+
+    script_nesting--;
+    return !error;
+}
+
+void cmd_run(const char* args) {
+    struct script s = {0};
+
+    s.file = *args ? ramfs_lookup(args) : 0;
+    if (!*args) {
+        terminal_writestring("Usage: run <file>\n");
+    } else if (!s.file) {
+        terminal_writestring("No such file: ");
+        terminal_writestring(args);
+        terminal_putchar('\n');
+    } else {
+        script_run(&s);
+    }
+}
+
+static void selftest_check(const char* name, int ok) {
+    if (ok) return;
+    selftest_failures++;
+    terminal_setcolor(make_color(LIGHT_RED, BLACK));
+    terminal_writestring("FAIL: ");
+    terminal_writestring(name);
+    terminal_putchar('\n');
+    terminal_setcolor(make_color(WHITE, BLACK));
+}
+
+void cmd_selftest() {
+    char buf[16];
+    char option[16];
+    uint32_t value = 0;
+
+    selftest_failures = 0;
+
+    selftest_check("str_len", str_len("kernel") == 6 && str_len("") == 0);
+    selftest_check("str_cmp equal", str_cmp("help", "help") == 0);
+    selftest_check("str_cmp order", str_cmp("abc", "abd") < 0 && str_cmp("b", "a") > 0);
+    selftest_check("str_cmp prefix", str_cmp("time", "timer") != 0);
+    str_copy(buf, "copy");
+    selftest_check("str_copy", str_cmp(buf, "copy") == 0);
+    selftest_check("str_to_uint", str_to_uint("4096", &value) && value == 4096);
+    selftest_check("str_to_uint reject", !str_to_uint("12a", &value) && !str_to_uint("", &value));
+    selftest_check("str_to_uint overflow", str_to_uint("4294967295", &value) && value == 0xFFFFFFFFu &&
+                                           !str_to_uint("4294967296", &value) &&
+                                           !str_to_uint("4294967306", &value));
+    str_copy(option, "mode=test");
+    selftest_check("str_split_option", str_cmp(str_split_option(option), "test") == 0 &&
+                                       str_cmp(option, "mode") == 0);
+    str_copy(option, "kernel.bin");
+    selftest_check("str_split_option bare", str_split_option(option) == 0);
+    selftest_check("kparam_find", kparam_find("hz") != 0 && kparam_find("nope") == 0);
+    {
+        const struct kparam* p = kparam_find("bench_iters");
+        uint32_t saved = bench_iterations;
+        selftest_check("kparam int", p && kparam_set(p, "500") && bench_iterations == 500);
+        selftest_check("kparam int range", p && !kparam_set(p, "0") && !kparam_set(p, "x") &&
+                                           !kparam_set(p, "4294967796"));
+        bench_iterations = saved;
+
+        p = kparam_find("serial_input");
+        int saved_input = serial_input;
+        selftest_check("kparam bool", p && kparam_set(p, "off") && serial_input == 0 &&
+                                      kparam_set(p, "on") && serial_input == 1 &&
+                                      !kparam_set(p, "maybe"));
+        serial_input = saved_input;
+
+        p = kparam_find("mode");
+        enum boot_mode saved_mode = boot_mode;
+        selftest_check("kparam enum", p && kparam_set(p, "bench") && boot_mode == BOOT_MODE_BENCH &&
+                                      !kparam_set(p, "fast"));
+        boot_mode = saved_mode;
+    }
+    if (pmm_total_count()) {
+        uint32_t before = pmm_free_count();
+        phys_addr_t a = pmm_alloc_frame();
+        phys_addr_t b = pmm_alloc_frame();
+        selftest_check("pmm alloc", a && b && a != b && !(a & (PAGE_SIZE - 1)) &&
+                                    pmm_free_count() == before - 2);
+        volatile uint32_t* p = phys_to_virt(a);
+        *p = 0x5A5AA5A5;
+        selftest_check("direct map", *(volatile uint32_t*)phys_to_virt(a) == 0x5A5AA5A5 &&
+                                     virt_to_phys((const void*)p) == a);
+        pmm_free_frame(b);
+        pmm_free_frame(a);
+        selftest_check("pmm free", pmm_free_count() == before);
+
+        phys_addr_t high = pmm_alloc_frame_high();
+        volatile uint32_t* k = kmap(high);
+        if (k) *k = 0xC0FFEE;
+        kunmap((void*)k);
+        k = high ? kmap(high) : 0;
+        selftest_check("kmap", k && *k == 0xC0FFEE);
+        kunmap((void*)k);
+        pmm_free_frame(high);
+
+        uint32_t local = numa_stats[numa_node_id()].local;
+        phys_addr_t f = pmm_alloc_frame();
+        selftest_check("numa local alloc", f && numa_stats[numa_node_id()].local == local + 1);
+        pmm_free_frame(f);
+
+        selftest_thread_runs = 0;
+        selftest_check("thread run", spawn_and_wait(3) &&
+                                     selftest_thread_runs == 3);
+        uint32_t reused = kstack_reuse_count();
+        selftest_check("kstack reuse", spawn_and_wait(1) &&
+                                       kstack_reuse_count() == reused + 1);
+
+        volatile uint32_t work_runs = 0;
+        struct work w;
+        work_init(&w, selftest_work, (void*)&work_runs);
+        selftest_check("work cancel", system_wq && queue_work(system_wq, &w) &&
+                                      !queue_work(system_wq, &w) &&
+                                      cancel_work(system_wq, &w) && work_runs == 0);
+        if (system_wq) {
+            queue_work(system_wq, &w);
+            flush_work(system_wq, &w);
+        }
+        selftest_check("work flush", work_runs == 1 && !cancel_work(system_wq, &w));
+
+        // The thread sleeps on the held mutex until it is released
+        uint32_t exits = selftest_thread_exits;
+        mutex_init(&selftest_mutex);
+        mutex_lock(&selftest_mutex);
+        selftest_thread_runs = 0;
+        int spawned = thread_create("selftest", selftest_mutex_thread, 0) != 0;
+        thread_yield();
+        int slept = spawned && selftest_thread_runs == 0 && !mutex_trylock(&selftest_mutex);
+        mutex_unlock(&selftest_mutex);
+        while (spawned && selftest_thread_exits == exits) thread_yield();
+        selftest_check("mutex sleep", slept && selftest_thread_runs == 1 &&
+                                      mutex_trylock(&selftest_mutex));
+        mutex_unlock(&selftest_mutex);
+
+        // Uncontended futex locks and signals never reach futex.c
+        struct fcond idle_cond = {0, 0};
+        uint32_t calls = futex_calls;
+        selftest_fmutex.state = 0;
+        fmutex_lock(&selftest_fmutex);
+        fcond_signal(&idle_cond);
+        fmutex_unlock(&selftest_fmutex);
+        selftest_check("futex fast path", futex_calls == calls && selftest_fmutex.state == 0 &&
+                                          futex_wait(&selftest_fmutex.state, 1) == -1);
+
+        // The thread sleeps on the fmutex, then signals the condition we
+        // wait on, which hands the fmutex over
+        exits = selftest_thread_exits;
+        selftest_fcond.seq = 0;
+        selftest_fcond.waiters = 0;
+        selftest_fcond_ready = 0;
+        selftest_thread_runs = 0;
+        fmutex_lock(&selftest_fmutex);
+        spawned = thread_create("selftest", selftest_fmutex_thread, 0) != 0;
+        thread_yield();
+        slept = spawned && selftest_thread_runs == 0 && selftest_fmutex.state == 2;
+        while (spawned && !selftest_fcond_ready) fcond_wait(&selftest_fcond, &selftest_fmutex);
+        fmutex_unlock(&selftest_fmutex);
+        while (spawned && selftest_thread_exits == exits) thread_yield();
+        selftest_check("futex mutex", slept && selftest_thread_runs == 1);
+        selftest_check("futex condvar", selftest_fcond_ready && !selftest_fcond.waiters);
+
+        // A removed node stays readable until the grace period ends
+        struct rcu_hlist table[4] = {{0}};
+        struct selftest_rcu_node rcu_nodes[8];
+        for (uint32_t i = 0; i < 8; i++) {
+            rcu_nodes[i].key = i;
+            rcu_hlist_add(&table[i % 4], &rcu_nodes[i].node);
+        }
+        int found = selftest_rcu_find(table, 5);
+        selftest_rcu_freed = 0;
+        rcu_hlist_del(&table[1], &rcu_nodes[5].node);
+        call_rcu(&rcu_nodes[5].rcu, selftest_rcu_free);
+        int deferred = selftest_rcu_freed == 0;
+        synchronize_rcu();
+        selftest_check("rcu", found && deferred && !selftest_rcu_find(table, 5) &&
+                              selftest_rcu_find(table, 1) && selftest_rcu_freed == 1);
+
+        // More than two magazines' worth forces depot exchanges both ways
+        void* objs[64];
+        int ok = 1;
+        for (int i = 0; i < 64; i++) {
+            objs[i] = kmalloc(24);
+            ok = ok && objs[i] && !((uintptr_t)objs[i] & 7);
+            for (int j = 0; ok && j < i; j++) ok = objs[j] != objs[i];
+        }
+        for (int i = 0; i < 64; i++) kfree(objs[i]);
+        selftest_check("kmalloc", ok && kmalloc(4096) == 0);
+        void* again = kmalloc(24);
+        selftest_check("kmalloc reuse", again == objs[63]);
+        kfree(again);
+
+        uint32_t freed = reclaim_stats.freed_objects;
+        reclaim_direct();
+        selftest_check("reclaim", reclaim_stats.freed_objects > freed &&
+                                  wmark_min < wmark_low && wmark_low < wmark_high);
+    }
+    {
+        uintptr_t offset;
+        const char* name = ksym_lookup((uintptr_t)cmd_selftest + 1, &offset);
+        selftest_check("ksym lookup", name && str_cmp(name, "cmd_selftest") == 0 && offset == 1 &&
+                                      ksym_lookup(0, 0) == 0);
+    }
+    {
+        // Scheduling twice before it runs queues it once
+        struct tasklet t;
+        tasklet_init(&t, selftest_tasklet, 0);
+        selftest_tasklet_runs = 0;
+        unsigned long flags = irq_save();
+        irq_enter();
+        tasklet_schedule(&t);
+        tasklet_schedule(&t);
+        irq_exit();
+        irq_restore(flags);
+        selftest_check("tasklet", selftest_tasklet_runs == 1 && !(t.state & TASKLET_SCHEDULED));
+    }
+    {
+        struct semaphore sem;
+        sema_init(&sem, 2);
+        down(&sem);
+        int took = down_trylock(&sem);
+        int empty = !down_trylock(&sem);
+        up(&sem);
+        selftest_check("semaphore", took && empty && down_trylock(&sem));
+    }
+    {
+        seqlock_t sl = {0};
+        uint32_t seq = read_seqbegin(&sl);
+        int clean = !read_seqretry(&sl, seq);
+        write_seqlock(&sl);
+        write_sequnlock(&sl);
+        selftest_check("seqlock", clean && read_seqretry(&sl, seq) && !(sl.sequence & 1));
+
+        uint64_t t1 = ktime_ns();
+        uint32_t ticks = timer_ticks;
+        while (timer_ticks == ticks) asm volatile("pause" ::: "memory");
+        uint64_t t2 = ktime_ns();
+        selftest_check("ktime", t2 > t1 && t2 - t1 <= 2000000000ULL / timer_hz);
+
+        // Through the user mapping, bracketed by two kernel reads
+        vdso_time_fn vdso = vdso_time_entry();
+        if (vdso) {
+            t1 = ktime_ns();
+            uint64_t tv = vdso();
+            t2 = ktime_ns();
+            selftest_check("vdso time", t1 <= tv && tv <= t2);
+        }
+    }
+    {
+        // Filling and draining from one thread never enters the kernel
+        struct chan* chans[2] = { chan_create(), chan_create() };
+        int ring_ok = chans[0] && chans[1];
+        struct chan_slot* slot;
+        uint32_t sent = 0, received = 0;
+
+        while (ring_ok && (slot = chan_reserve(chans[0]))) {
+            slot->data[0] = (char)sent++;
+            chan_publish(chans[0], 1);
+        }
+        while (ring_ok && (slot = chan_peek(chans[0]))) {
+            if (slot->data[0] == (char)received) received++;
+            chan_consume(chans[0]);
+        }
+        ring_ok = ring_ok && sent == CHAN_SLOTS && received == CHAN_SLOTS &&
+                  !chans[0]->sleeps && !chans[0]->wakeups;
+        selftest_check("chan ring", ring_ok);
+        selftest_check("chan pingpong", ring_ok && chan_pingpong(chans, 100) == 101 &&
+                                        chans[0]->wakeups && chans[1]->wakeups);
+        if (chans[0]) chan_destroy(chans[0]);
+        if (chans[1]) chan_destroy(chans[1]);
+    }
+    {
+        struct pipe* p = pipe_create();
+        char buf[16];
+        int eof = p && pipe_write(p, "abc", 3) == 3 && pipe_read(p, buf, sizeof(buf)) == 3 &&
+                  buf[2] == 'c';
+        if (p) {
+            pipe_close_write(p);
+            eof = eof && pipe_read(p, buf, sizeof(buf)) == 0;
+            pipe_close_read(p);
+        }
+        selftest_check("pipe eof", eof);
+
+        // The last command of a pipeline writes wherever we do: here, a pipe
+        struct pipe* capture = pipe_create();
+        struct sink capture_sink = { SINK_PIPE, capture };
+        struct sink* saved_out = current_thread->out;
+        int n = 0;
+        if (capture) {
+            current_thread->out = &capture_sink;
+            shell_execute("echo one two | wc");
+            current_thread->out = saved_out;
+            pipe_close_write(capture);
+            n = pipe_read(capture, buf, sizeof(buf) - 1);
+            pipe_close_read(capture);
+        }
+        buf[n] = '\0';
+        selftest_check("pipeline", str_cmp(buf, "1 2 8\n") == 0);
+
+        shell_execute("echo one > /tmp/selftest");
+        shell_execute("echo two >> /tmp/selftest");
+        struct ramfs_file* f = ramfs_lookup("/tmp/selftest");
+        n = f ? (int)ramfs_read(f, 0, buf, sizeof(buf) - 1) : 0;
+        buf[n] = '\0';
+        selftest_check("redirect", str_cmp(buf, "one\ntwo\n") == 0);
+
+        // Writes that cross a page boundary read back in order
+        int intact = f != 0;
+        if (f) ramfs_truncate(f);
+        for (uint32_t pos = 0; intact && pos < 5000; pos++) {
+            char c = (char)('a' + pos % 26);
+            intact = ramfs_write(f, &c, 1) == 1;
+        }
+        intact = intact && ramfs_size(f) == 5000 && ramfs_read(f, 4090, buf, 12) == 12;
+        for (uint32_t k = 0; intact && k < 12; k++) {
+            intact = buf[k] == (char)('a' + (4090 + k) % 26);
+        }
+        selftest_check("ramfs", intact && ramfs_unlink("/tmp/selftest") &&
+                                !ramfs_lookup("/tmp/selftest"));
+
+        char expanded[32];
+        shell_var_set("selftest", "x");
+        shell_expand("a$selftest \\$selftest $none.", expanded, sizeof(expanded));
+        shell_var_set("selftest", "");
+        selftest_check("variables", str_cmp(expanded, "ax $selftest .") == 0);
+
+        // Nested loops, one skipped, writing their counters to a file
+        static const char script[] =
+            "repeat 2 a\n"
+            "  repeat 0\n"
+            "    echo skipped >> /tmp/selftest\n"
+            "  end\n"
+            "  repeat 2 b\n"
+            "    echo $a$b >> /tmp/selftest\n"
+            "  end\n"
+            "end\n";
+        int saved_echo = script_echo;
+        script_echo = 0;
+        shell_run_script(script, sizeof(script) - 1);
+        script_echo = saved_echo;
+        shell_var_set("a", "");
+        shell_var_set("b", "");
+        f = ramfs_lookup("/tmp/selftest");
+        n = f ? (int)ramfs_read(f, 0, buf, sizeof(buf) - 1) : 0;
+        buf[n] = '\0';
+        ramfs_unlink("/tmp/selftest");
+        selftest_check("script loops", str_cmp(buf, "11\n12\n21\n22\n") == 0);
+    }
+    selftest_check("div64_u32", div64_u32(0x500000000ULL, 5) == 0x100000000ULL);
+    selftest_check("scancode map", keyboard_scancode_to_ascii(0x1E) == 'a' &&
+                                   keyboard_scancode_to_ascii(0x1C) == '\n' &&
+                                   keyboard_scancode_to_ascii(0xFF) == 0);
+
+    terminal_writestring("selftest: ");
+    terminal_writestring(selftest_failures ? "FAILED (" : "PASSED (");
+    terminal_writedec(selftest_failures);
+    terminal_writestring(" failures)\n");
+}
+
+KPARAM_INT(bench_iters, bench_iterations, 1, 1000000, 0, "Iterations per benchmark");
+
+static void bench_report(const char* name, uint64_t cycles) {
+    terminal_writestring("BENCH ");
+    terminal_writestring(name);
+    terminal_putchar(' ');
+    terminal_writedec((uint32_t)div64_u32(cycles, bench_iterations));
+    terminal_writestring(" cycles/op\n");
+}
+
+void cmd_bench() {
+    static volatile int sink;
+    uint64_t start, t_putchar, t_scroll, t_writedec, t_strcmp, t_scancode, t_kmalloc, t_spawn;
+    uint64_t t_tasklet, t_ktime, t_vdso = 0, t_chan = 0, t_pingpong = 0, t_fmutex, t_pipe = 0;
+    struct pipe* pipe = pipe_create();
+    char pipe_buf[64] = {0};
+    struct sink null_sink = { SINK_NULL, 0 };
+    struct sink* saved_out = current_thread->out;
+    uint64_t t_writedec_null;
+    struct fmutex fm = {0};
+    struct chan* chans[2] = { chan_create(), chan_create() };
+    vdso_time_fn vdso = vdso_time_entry();
+    struct tasklet tasklet;
+    enum console_mode saved_console = console_mode;
+
+    // Measure the VGA paths alone; serial mirroring would dominate
+    console_mode = CONSOLE_VGA;
+
+    start = rdtsc();
+    for (uint32_t i = 0; i < bench_iterations; i++) {
+        terminal_putchar('x');
+    }
+    t_putchar = rdtsc() - start;
+
+    terminal_setpos(VGA_HEIGHT - 1, 0);
+    start = rdtsc();
+    for (uint32_t i = 0; i < bench_iterations; i++) {
+        terminal_putchar('\n');
+    }
+    t_scroll = rdtsc() - start;
+
+    start = rdtsc();
+    for (uint32_t i = 0; i < bench_iterations; i++) {
+        terminal_writedec(4294967295U);
+    }
+    t_writedec = rdtsc() - start;
+
+    console_mode = saved_console;
+    terminal_initialize();
+
+    // The same output thrown away by a sink, as with "> /dev/null". From
+    // here on each run starts with a yield (never one inside it), so a bg
+    // bench lets the console in; the VGA runs above share the screen.
+    current_thread->out = &null_sink;
+    thread_yield();
+    start = rdtsc();
+    for (uint32_t i = 0; i < bench_iterations; i++) {
+        terminal_writedec(4294967295U);
+    }
+    t_writedec_null = rdtsc() - start;
+    current_thread->out = saved_out;
+
+    thread_yield();
+    start = rdtsc();
+    for (uint32_t i = 0; i < bench_iterations; i++) {
+        sink += str_cmp("shutdown", "shutdowx");
+    }
+    t_strcmp = rdtsc() - start;
+
+    thread_yield();
+    start = rdtsc();
+    for (uint32_t i = 0; i < bench_iterations; i++) {
+        sink += keyboard_scancode_to_ascii((uint8_t)i);
+    }
+    t_scancode = rdtsc() - start;
+
+    thread_yield();
+    start = rdtsc();
+    for (uint32_t i = 0; i < bench_iterations; i++) {
+        void* p = kmalloc(64);
+        kfree(p);
+    }
+    t_kmalloc = rdtsc() - start;
+
+    // Create, switch to, exit and reap a thread; stacks come from the pool
+    thread_yield();
+    start = rdtsc();
+    for (uint32_t i = 0; i < bench_iterations; i++) {
+        spawn_and_wait(0);
+    }
+    t_spawn = rdtsc() - start;
+
+    // Queue from a simulated interrupt and run it on the way out
+    tasklet_init(&tasklet, selftest_tasklet, 0);
+    thread_yield();
+    start = rdtsc();
+    for (uint32_t i = 0; i < bench_iterations; i++) {
+        unsigned long flags = irq_save();
+        irq_enter();
+        tasklet_schedule(&tasklet);
+        irq_exit();
+        irq_restore(flags);
+    }
+    t_tasklet = rdtsc() - start;
+
+    thread_yield();
+    start = rdtsc();
+    for (uint32_t i = 0; i < bench_iterations; i++) {
+        sink += (int)ktime_ns();
+    }
+    t_ktime = rdtsc() - start;
+
+    if (vdso) {
+        thread_yield();
+        start = rdtsc();
+        for (uint32_t i = 0; i < bench_iterations; i++) {
+            sink += (int)vdso();
+        }
+        t_vdso = rdtsc() - start;
+    }
+
+    thread_yield();
+    start = rdtsc();
+    for (uint32_t i = 0; i < bench_iterations; i++) {
+        fmutex_lock(&fm);
+        fmutex_unlock(&fm);
+    }
+    t_fmutex = rdtsc() - start;
+
+    // One message through the ring without any wakeup, then a round trip
+    // to another thread and back, sleeping on each side
+    if (chans[0] && chans[1]) {
+        thread_yield();
+        start = rdtsc();
+        for (uint32_t i = 0; i < bench_iterations; i++) {
+            chan_reserve(chans[0])->data[0] = (char)i;
+            chan_publish(chans[0], 1);
+            sink += chan_peek(chans[0])->data[0];
+            chan_consume(chans[0]);
+        }
+        t_chan = rdtsc() - start;
+
+        thread_yield();
+        start = rdtsc();
+        chan_pingpong(chans, bench_iterations);
+        t_pingpong = rdtsc() - start;
+    }
+    if (chans[0]) chan_destroy(chans[0]);
+    if (chans[1]) chan_destroy(chans[1]);
+
+    // 64 bytes through a pipe and back out, one thread on both ends
+    if (pipe) {
+        thread_yield();
+        start = rdtsc();
+        for (uint32_t i = 0; i < bench_iterations; i++) {
+            pipe_write(pipe, pipe_buf, sizeof(pipe_buf));
+            sink += pipe_read(pipe, pipe_buf, sizeof(pipe_buf));
+        }
+        t_pipe = rdtsc() - start;
+        pipe_close_write(pipe);
+        pipe_close_read(pipe);
+    }
+
+    bench_report("putchar", t_putchar);
+    bench_report("scroll", t_scroll);
+    bench_report("writedec", t_writedec);
+    bench_report("writedec_null", t_writedec_null);
+    bench_report("str_cmp", t_strcmp);
+    bench_report("scancode", t_scancode);
+    bench_report("kmalloc", t_kmalloc);
+    bench_report("spawn", t_spawn);
+    bench_report("tasklet", t_tasklet);
+    bench_report("ktime", t_ktime);
+    if (vdso) bench_report("vdso_time", t_vdso);
+    bench_report("fmutex", t_fmutex);
+    if (pipe) bench_report("pipe_64B", t_pipe);
+    if (t_chan) {
+        bench_report("chan_msg", t_chan);
+        bench_report("chan_pingpong", t_pingpong);
+    }
+}
+
+void cmd_exit(const char* args) {
+    uint32_t code = selftest_failures;
+
+    if (*args && !str_to_uint(args, &code)) {
+        terminal_writestring("Usage: exit [code]\n");
+        return;
+    }
+
+    debug_exit((uint8_t)code);
+
+    // Still here: no isa-debug-exit device
+    terminal_writestring("exit: not running under QEMU with isa-debug-exit\n");
+}
+
+static void kparam_print(const struct kparam* p) {
+    terminal_writestring(p->name);
+    terminal_writestring(" = ");
+    switch (p->type) {
+    case KPARAM_TYPE_INT:
+        terminal_writedec(*(uint32_t*)p->value);
+        break;
+    case KPARAM_TYPE_BOOL:
+        terminal_writestring(*(int*)p->value ? "on" : "off");
+        break;
+    case KPARAM_TYPE_ENUM:
+        terminal_writestring(p->names[*(int*)p->value]);
+        break;
+    }
+}
+
+void cmd_sysctl(const char* args) {
+    char option[64];
+    char* value;
+    const struct kparam* p;
+    int len = 0;
+
+    if (!*args) {
+        for (p = __kparam_start; p < __kparam_end; p++) {
+            terminal_writestring("  ");
+            kparam_print(p);
+            terminal_setcolor(make_color(DARK_GREY, BLACK));
+            terminal_writestring("  # ");
+            terminal_writestring(p->desc);
+            terminal_setcolor(make_color(WHITE, BLACK));
+            terminal_putchar('\n');
+        }
+        return;
+    }
+
+    while (args[len] && len < 63) {
+        option[len] = args[len];
+        len++;
+    }
+    option[len] = '\0';
+    value = str_split_option(option);
+
+    p = kparam_find(option);
+    if (!p) {
+        terminal_writestring("sysctl: unknown parameter ");
+        terminal_writestring(option);
+        terminal_putchar('\n');
+        return;
+    }
+
+    if (value && !kparam_set(p, value)) {
+        terminal_writestring("sysctl: invalid value for ");
+        terminal_writestring(p->name);
+        if (p->type == KPARAM_TYPE_INT) {
+            terminal_writestring(" (");
+            terminal_writedec(p->min);
+            terminal_writestring("..");
+            terminal_writedec(p->max);
+            terminal_putchar(')');
+        } else if (p->type == KPARAM_TYPE_ENUM) {
+            terminal_writestring(" (");
+            for (uint32_t i = p->min; i <= p->max; i++) {
+                terminal_writestring(p->names[i]);
+                if (i < p->max) terminal_putchar('|');
+            }
+            terminal_putchar(')');
+        }
+        terminal_putchar('\n');
+        return;
+    }
+
+    kparam_print(p);
+    terminal_putchar('\n');
+}
+
+// Pipeline filters read what the previous command wrote
+
+// One line of pipeline input without its newline. Returns the length, or
+// -1 at end of input.
+static int stdin_read_line(char* line, int max) {
+    int len = 0;
+    char c = 0;
+
+    while (pipe_read(current_thread->in, &c, 1) == 1) {
+        if (c == '\n') break;
+        if (len < max - 1) line[len++] = c;
+    }
+    line[len] = '\0';
+    return (len || c == '\n') ? len : -1;
+}
+
+static int str_contains(const char* str, const char* text) {
+    for (; *str; str++) {
+        int i = 0;
+        while (text[i] && str[i] == text[i]) i++;
+        if (!text[i]) return 1;
+    }
+    return !*text;
+}
+
+void cmd_grep(const char* args) {
+    char line[256];
+
+    if (!current_thread->in || !*args) {
+        terminal_writestring("Usage: <command> | grep <text>\n");
+        return;
+    }
+    while (stdin_read_line(line, sizeof(line)) >= 0) {
+        if (!str_contains(line, args)) continue;
+        terminal_writestring(line);
+        terminal_putchar('\n');
+    }
+}
+
+void cmd_wc() {
+    uint32_t lines = 0, words = 0, bytes = 0;
+    int in_word = 0;
+    char buf[64];
+    int n;
+
+    if (!current_thread->in) {
+        terminal_writestring("Usage: <command> | wc\n");
+        return;
+    }
+    while ((n = pipe_read(current_thread->in, buf, sizeof(buf))) > 0) {
+        for (int i = 0; i < n; i++) {
+            int space = buf[i] == ' ' || buf[i] == '\n' || buf[i] == '\t';
+            if (buf[i] == '\n') lines++;
+            if (!space && !in_word) words++;
+            in_word = !space;
+        }
+        bytes += n;
+    }
+    terminal_writedec(lines);
+    terminal_putchar(' ');
+    terminal_writedec(words);
+    terminal_putchar(' ');
+    terminal_writedec(bytes);
+    terminal_putchar('\n');
+}
+
+// Stops reading after count lines; the writer then sees a closed pipe
+void cmd_head(const char* args) {
+    uint32_t count = 10;
+    char line[256];
+
+    if (!current_thread->in || (*args && !str_to_uint(args, &count))) {
+        terminal_writestring("Usage: <command> | head [count]\n");
+        return;
+    }
+    while (count-- && stdin_read_line(line, sizeof(line)) >= 0) {
+        terminal_writestring(line);
+        terminal_putchar('\n');
+    }
+}
+
+void cmd_ls() {
+    ramfs_report();
+}
+
+void cmd_cat(const char* args) {
+    struct ramfs_file* f = *args ? ramfs_lookup(args) : 0;
+    char buf[64];
+    uint32_t pos = 0, n;
+
+    if (!*args) {
+        terminal_writestring("Usage: cat <file>\n");
+        return;
+    }
+    if (!f) {
+        terminal_writestring("No such file: ");
+        terminal_writestring(args);
+        terminal_putchar('\n');
+        return;
+    }
+    while ((n = ramfs_read(f, pos, buf, sizeof(buf) - 1)) > 0) {
+        buf[n] = '\0';
+        terminal_writestring(buf);
+        pos += n;
+    }
+}
+
+void cmd_rm(const char* args) {
+    if (!*args) {
+        terminal_writestring("Usage: rm <file>\n");
+    } else if (!ramfs_unlink(args)) {
+        terminal_writestring("No such file: ");
+        terminal_writestring(args);
+        terminal_putchar('\n');
+    }
+}
+
+// cmd > path replaces path with the output of cmd, cmd >> path appends
+// to it. A missing command just creates or empties the file.
+static void shell_redirect(const char* line, const char* op) {
+    char cmd[256];
+    char path[RAMFS_NAME_MAX];
+    int len = 0;
+    int append = op[1] == '>';
+    struct sink sink;
+    struct sink* saved_out = current_thread->out;
+
+    while (line < op) cmd[len++] = *line++;
+    while (len > 0 && cmd[len - 1] == ' ') len--;
+    cmd[len] = '\0';
+
+    op += append ? 2 : 1;
+    while (*op == ' ') op++;
+    len = 0;
+    while (*op && *op != ' ' && len < RAMFS_NAME_MAX - 1) path[len++] = *op++;
+    path[len] = '\0';
+    while (*op == ' ') op++;
+
+    if (!len || *op) {
+        terminal_writestring("Usage: <command> > <file>, or >> to append\n");
+        return;
+    }
+    if (!sink_open(&sink, path, append)) {
+        terminal_writestring("Cannot open ");
+        terminal_writestring(path);
+        terminal_putchar('\n');
+        return;
+    }
+    if (*cmd) {
+        current_thread->out = &sink;
+        shell_execute(cmd);
+        current_thread->out = saved_out;
+    }
+}
+
+// Pipelines: every command but the last runs on a thread of its own with
+// its output going into a pipe to the next one. The last runs here and
+// writes wherever this thread's output goes.
+#define PIPELINE_MAX 4
+
+struct pipeline_stage {
+    char line[256];
+    struct pipe* in;
+    struct pipe* out;
+    struct sink out_sink;
+    struct semaphore* done;
+};
+
+// Closing both ends afterwards gives the next command end of file and
+// tells the previous one nobody is reading any more
+static void pipeline_stage_run(struct pipeline_stage* st) {
+    struct pipe* saved_in = current_thread->in;
+    struct sink* saved_out = current_thread->out;
+
+    current_thread->in = st->in;
+    if (st->out) {
+        st->out_sink.type = SINK_PIPE;
+        st->out_sink.target = st->out;
+        current_thread->out = &st->out_sink;
+    }
+    shell_execute(st->line);
+    current_thread->in = saved_in;
+    current_thread->out = saved_out;
+
+    if (st->in) pipe_close_read(st->in);
+    if (st->out) pipe_close_write(st->out);
+}
+
+static void pipeline_thread(void* arg) {
+    struct pipeline_stage* st = arg;
+
+    pipeline_stage_run(st);
+    up(st->done);
+}
+
+static void shell_pipeline(const char* line) {
+    struct pipeline_stage* stages[PIPELINE_MAX];
+    struct semaphore done;
+    int count = 0;
+    const char* error = 0;
+
+    while (!error) {
+        int len = 0;
+
+        if (count == PIPELINE_MAX) {
+            error = "Too many commands in pipeline\n";
+            break;
+        }
+        stages[count] = kmalloc(sizeof(struct pipeline_stage));
+        if (!stages[count]) {
+            error = "Out of memory\n";
+            break;
+        }
+        while (*line == ' ') line++;
+        while (*line && *line != '|') stages[count]->line[len++] = *line++;
+        while (len > 0 && stages[count]->line[len - 1] == ' ') len--;
+        stages[count]->line[len] = '\0';
+        stages[count]->in = count ? stages[count - 1]->out : 0;
+        stages[count]->out = 0;
+        stages[count]->done = &done;
+        count++;
+
+        if (!len) error = "Empty command in pipeline\n";
+        else if (!*line++) break;
+        else if (!(stages[count - 1]->out = pipe_create())) error = "Out of memory\n";
+    }
+
+    if (error) {
+        terminal_writestring(error);
+        for (int i = 0; i < count; i++) {
+            if (stages[i]->out) {
+                pipe_close_read(stages[i]->out);
+                pipe_close_write(stages[i]->out);
+            }
+            kfree(stages[i]);
+        }
+        return;
+    }
+
+    sema_init(&done, 0);
+    for (int i = 0; i < count - 1; i++) {
+        if (!thread_create("pipe", pipeline_thread, stages[i])) {
+            terminal_writestring("Cannot start: ");
+            terminal_writestring(stages[i]->line);
+            terminal_putchar('\n');
+            if (stages[i]->in) pipe_close_read(stages[i]->in);
+            pipe_close_write(stages[i]->out);
+            up(&done);
+        }
+    }
+    pipeline_stage_run(stages[count - 1]);
+    for (int i = 0; i < count - 1; i++) {
+        down(&done);
+    }
+    for (int i = 0; i < count; i++) {
+        kfree(stages[i]);
+    }
+}
+
+void cmd_shutdown() {
+    terminal_setcolor(make_color(LIGHT_RED, BLACK));
+    terminal_writestring("\nShutting down...\n");
+    terminal_writestring("System halted. You can close the window now.\n");
+    
+    while(1) {
+        asm volatile("hlt");
+    }
+}
+
+// Parse and run one command line
+__hot void shell_execute(const char* line) {
+    // Parse command
+    char cmd[256];
+    char args[256];
+    int i = 0, j = 0;
+    const char* redirect = 0;
+    const char* timed = str_word(line, "time");
+
+    if (timed && *timed) {
+        shell_time(timed);
+        return;
+    }
+
+    // Pipelines split first, so each command may have its own redirection
+    for (const char* p = line; *p; p++) {
+        if (*p == '|') {
+            shell_pipeline(line);
+            return;
+        }
+        if (*p == '>' && !redirect) redirect = p;
+    }
+    if (redirect) {
+        shell_redirect(line, redirect);
+        return;
+    }
+
+    // Extract command
+    while (line[i] && line[i] != ' ') {
+        cmd[j++] = line[i++];
+    }
+    cmd[j] = '\0';
+    
+    // Skip spaces
+    while (line[i] == ' ') i++;
+    
+    // Extract arguments
+    j = 0;
+    while (line[i]) {
+        args[j++] = line[i++];
+    }
+    args[j] = '\0';
+    
+    // Execute command
+    if (str_cmp(cmd, "help") == 0) {
+        cmd_help();
+    } else if (str_cmp(cmd, "clear") == 0) {
+        terminal_initialize();
+    } else if (str_cmp(cmd, "echo") == 0) {
+        cmd_echo(args);
+    } else if (str_cmp(cmd, "time") == 0) {
+        cmd_time();
+    } else if (str_cmp(cmd, "sysinfo") == 0) {
+        cmd_sysinfo();
+    } else if (str_cmp(cmd, "meminfo") == 0) {
+        cmd_meminfo();
+    } else if (str_cmp(cmd, "slabinfo") == 0) {
+        kmem_report();
+    } else if (str_cmp(cmd, "numastat") == 0) {
+        numa_report();
+    } else if (str_cmp(cmd, "threads") == 0) {
+        thread_report();
+    } else if (str_cmp(cmd, "softirqs") == 0) {
+        terminal_writestring("Softirqs:\n");
+        softirq_report();
+    } else if (str_cmp(cmd, "workqueues") == 0) {
+        workqueue_report();
+    } else if (str_cmp(cmd, "rcu") == 0) {
+        rcu_report();
+    } else if (str_cmp(cmd, "bg") == 0) {
+        cmd_bg(args);
+    } else if (str_cmp(cmd, "crash") == 0) {
+        cmd_crash(args);
+    } else if (str_cmp(cmd, "backtrace") == 0) {
+        cmd_backtrace();
+    } else if (str_cmp(cmd, "prof") == 0) {
+        cmd_prof(args);
+    } else if (str_cmp(cmd, "colors") == 0) {
+        cmd_colors();
+    } else if (str_cmp(cmd, "box") == 0) {
+        cmd_box();
+    } else if (str_cmp(cmd, "banner") == 0) {
+        cmd_banner();
+    } else if (str_cmp(cmd, "selftest") == 0) {
+        cmd_selftest();
+    } else if (str_cmp(cmd, "bench") == 0) {
+        cmd_bench();
+    } else if (str_cmp(cmd, "exit") == 0) {
+        cmd_exit(args);
+    } else if (str_cmp(cmd, "sysctl") == 0) {
+        cmd_sysctl(args);
+    } else if (str_cmp(cmd, "grep") == 0) {
+        cmd_grep(args);
+    } else if (str_cmp(cmd, "wc") == 0) {
+        cmd_wc();
+    } else if (str_cmp(cmd, "head") == 0) {
+        cmd_head(args);
+    } else if (str_cmp(cmd, "ls") == 0) {
+        cmd_ls();
+    } else if (str_cmp(cmd, "cat") == 0) {
+        cmd_cat(args);
+    } else if (str_cmp(cmd, "rm") == 0) {
+        cmd_rm(args);
+    } else if (str_cmp(cmd, "set") == 0) {
+        cmd_set(args);
+    } else if (str_cmp(cmd, "run") == 0) {
+        cmd_run(args);
+    } else if (str_cmp(cmd, "repeat") == 0 || str_cmp(cmd, "end") == 0) {
+        terminal_writestring("repeat and end only work in scripts (run <file>)\n");
+#ifdef KERNEL_GCOV
+    } else if (str_cmp(cmd, "gcov") == 0) {
+        gcov_dump();
+#endif
+    } else if (str_cmp(cmd, "shutdown") == 0) {
+        cmd_shutdown();
+    } else {
+        terminal_setcolor(make_color(LIGHT_RED, BLACK));
+        terminal_writestring("Unknown command: ");
+        terminal_writestring(cmd);
+        terminal_writestring("\nType 'help' for available commands.\n");
+        terminal_setcolor(make_color(WHITE, BLACK));
+    }
+}
+
+// Shell
+void kernel_shell() {
+    terminal_setcolor(make_color(LIGHT_GREEN, BLACK));
+    terminal_writestring("\nWelcome to SimpleOS Shell!\n");
+    terminal_writestring("Type 'help' for available commands.\n\n");
+    
+    char buffer[256];
+    int pos = 0;
+    
+    while (1) {
+        terminal_setcolor(make_color(LIGHT_BLUE, BLACK));
+        terminal_writestring("shell> ");
+        terminal_setcolor(make_color(WHITE, BLACK));
+        
+        pos = 0;
+        
+        while (1) {
+            char c = keyboard_read_char();
+            
+            if (c == '\n') {
+                terminal_putchar('\n');
+                buffer[pos] = '\0';
+                break;
+            } else if (c == '\b' && pos > 0) {
+                pos--;
+                terminal_backspace();
+            } else if (c >= 32 && c <= 126 && pos < 255) {
+                buffer[pos++] = c;
+                terminal_putchar(c);
+            }
+        }
+        
+        if (pos == 0) continue;
+
+        char expanded[256];
+        shell_expand(buffer, expanded, sizeof(expanded));
+        shell_execute(expanded);
+    }
+}
+
+// Run a text buffer (e.g. a multiboot module) as a script
+void shell_run_script(const char* text, size_t size) {
+    struct script s = {0};
+
+    s.text = text;
+    s.size = (uint32_t)size;
+    script_run(&s);
+}
+
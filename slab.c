@@ -0,0 +1,386 @@
+// slab.c - Object caches with per-CPU magazines
+//
+// Each cache carves single-frame slabs into fixed-size objects. In front of
+// the slabs sits a Bonwick-style magazine layer: every CPU owns a loaded and
+// a previous magazine (small stacks of free objects) and only takes the
+// cache lock to swap a full or empty magazine with the depot. The per-CPU
+// state is cache-line aligned, so allocation and free in the common case
+// write nothing another CPU reads.
+
+#include "kernel.h"
+
+#define MAGAZINE_SIZE 15
+#define KMEM_CACHES_MAX 32
+#define KMEM_NO_MAGAZINES 1
+
+struct slab {
+    struct slab* next;
+    struct slab* prev;
+    struct kmem_cache* cache;
+    void* free;                 // Free objects, linked through their first word
+    uint32_t inuse;
+};
+
+struct kmem_magazine {
+    struct kmem_magazine* next;
+    uint32_t rounds;
+    void* objs[MAGAZINE_SIZE];
+};
+
+struct kmem_cpu_cache {
+    struct kmem_magazine* loaded;
+    struct kmem_magazine* previous;
+    uint32_t hits;              // Served without the cache lock
+    uint32_t misses;
+} __attribute__((aligned(64)));
+
+// The fast paths only read the fields before lock; everything the lock
+// protects sits on lines of its own, so refills and flushes do not keep
+// pulling the read-mostly line away from the other CPUs
+struct kmem_cache {
+    struct kmem_cpu_cache cpu[NR_CPUS];
+
+    const char* name;
+    uint32_t size;
+    uint32_t per_slab;
+    uint32_t flags;
+
+    spinlock_t lock __attribute__((aligned(64)));   // Slab lists and depot
+    struct slab* partial;       // Slabs with at least one free object
+    uint32_t slabs;
+    uint32_t inuse;             // Objects handed out, including those in magazines
+    struct kmem_magazine* depot_full;
+    struct kmem_magazine* depot_empty;
+    uint32_t depot_full_count;
+    uint32_t depot_empty_count;
+};
+
+static struct kmem_cache cache_pool[KMEM_CACHES_MAX];
+static uint32_t cache_count = 0;
+static struct kmem_cache* magazine_cache = 0;
+
+// kmalloc size classes
+static const uint32_t kmalloc_sizes[] = { 16, 32, 64, 128, 256, 512, 1024, 2048 };
+static const char* const kmalloc_names[] = {
+    "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+    "kmalloc-256", "kmalloc-512", "kmalloc-1024", "kmalloc-2048"
+};
+static struct kmem_cache* kmalloc_caches[sizeof(kmalloc_sizes) / sizeof(kmalloc_sizes[0])];
+
+#define SLAB_HEADER_SIZE ((sizeof(struct slab) + 15) & ~15U)
+
+static inline struct slab* slab_of(void* obj) {
+    return (struct slab*)((uintptr_t)obj & ~(uintptr_t)(PAGE_SIZE - 1));
+}
+
+static void slab_unlink(struct kmem_cache* cache, struct slab* slab) {
+    if (slab->prev) slab->prev->next = slab->next;
+    else cache->partial = slab->next;
+    if (slab->next) slab->next->prev = slab->prev;
+    slab->next = slab->prev = 0;
+}
+
+static void slab_push(struct kmem_cache* cache, struct slab* slab) {
+    slab->prev = 0;
+    slab->next = cache->partial;
+    if (cache->partial) cache->partial->prev = slab;
+    cache->partial = slab;
+}
+
+static struct slab* slab_grow(struct kmem_cache* cache) {
+    phys_addr_t frame = pmm_alloc_frame();
+    if (!frame) return 0;
+
+    struct slab* slab = phys_to_virt(frame);
+    char* obj = (char*)slab + SLAB_HEADER_SIZE;
+
+    slab->cache = cache;
+    slab->inuse = 0;
+    slab->free = 0;
+    for (uint32_t i = 0; i < cache->per_slab; i++) {
+        *(void**)obj = slab->free;
+        slab->free = obj;
+        obj += cache->size;
+    }
+    slab_push(cache, slab);
+    cache->slabs++;
+    return slab;
+}
+
+// Slab layer; called with the cache lock held
+static void* slab_alloc(struct kmem_cache* cache) {
+    struct slab* slab = cache->partial;
+
+    if (!slab && !(slab = slab_grow(cache))) return 0;
+
+    void* obj = slab->free;
+    slab->free = *(void**)obj;
+    slab->inuse++;
+    cache->inuse++;
+    if (!slab->free) slab_unlink(cache, slab);
+    return obj;
+}
+
+static void slab_free(struct kmem_cache* cache, void* obj) {
+    struct slab* slab = slab_of(obj);
+
+    if (!slab->free) slab_push(cache, slab);
+    *(void**)obj = slab->free;
+    slab->free = obj;
+    slab->inuse--;
+    cache->inuse--;
+
+    // Keep one empty slab around so a single alloc/free pair does not thrash
+    if (slab->inuse == 0 && (slab->next || slab->prev)) {
+        slab_unlink(cache, slab);
+        cache->slabs--;
+        pmm_free_frame(virt_to_phys(slab));
+    }
+}
+
+static struct kmem_cache* kmem_cache_create_flags(const char* name, uint32_t size, uint32_t flags) {
+    size = (size + 7) & ~7U;
+    if (size < sizeof(void*)) size = sizeof(void*);
+    if (size > PAGE_SIZE - SLAB_HEADER_SIZE || cache_count == KMEM_CACHES_MAX) return 0;
+
+    unsigned long irq = irq_save();
+    struct kmem_cache* cache = &cache_pool[cache_count++];
+    irq_restore(irq);
+
+    cache->name = name;
+    cache->size = size;
+    cache->per_slab = (PAGE_SIZE - SLAB_HEADER_SIZE) / size;
+    cache->flags = flags;
+    return cache;
+}
+
+struct kmem_cache* kmem_cache_create(const char* name, uint32_t size) {
+    return kmem_cache_create_flags(name, size, 0);
+}
+
+// Slow half of kmem_cache_alloc: trade the empty previous magazine for a
+// full one from the depot, or fall back to the slab layer
+static void* kmem_cache_alloc_slow(struct kmem_cache* cache, struct kmem_cpu_cache* cc) {
+    void* obj;
+
+    cc->misses++;
+    spin_lock(&cache->lock);
+    if (cache->depot_full) {
+        if (cc->previous) {
+            cc->previous->next = cache->depot_empty;
+            cache->depot_empty = cc->previous;
+            cache->depot_empty_count++;
+        }
+        cc->previous = cc->loaded;
+        cc->loaded = cache->depot_full;
+        cache->depot_full = cc->loaded->next;
+        cache->depot_full_count--;
+        obj = cc->loaded->objs[--cc->loaded->rounds];
+    } else {
+        obj = slab_alloc(cache);
+    }
+    spin_unlock(&cache->lock);
+    return obj;
+}
+
+__hot void* kmem_cache_alloc(struct kmem_cache* cache) {
+    unsigned long flags = irq_save();
+    struct kmem_cpu_cache* cc = &cache->cpu[cpu_id()];
+    struct kmem_magazine* mag;
+    void* obj;
+
+    if (cache->flags & KMEM_NO_MAGAZINES) {
+        spin_lock(&cache->lock);
+        obj = slab_alloc(cache);
+        spin_unlock(&cache->lock);
+    } else if ((mag = cc->loaded) && mag->rounds) {
+        obj = mag->objs[--mag->rounds];
+        cc->hits++;
+    } else if ((mag = cc->previous) && mag->rounds) {
+        cc->previous = cc->loaded;
+        cc->loaded = mag;
+        obj = mag->objs[--mag->rounds];
+        cc->hits++;
+    } else {
+        obj = kmem_cache_alloc_slow(cache, cc);
+    }
+
+    irq_restore(flags);
+    return obj;
+}
+
+// Slow half of kmem_cache_free: trade the full previous magazine for an
+// empty one from the depot (or a new one), or free to the slab layer
+static void kmem_cache_free_slow(struct kmem_cache* cache, struct kmem_cpu_cache* cc, void* obj) {
+    struct kmem_magazine* empty;
+
+    cc->misses++;
+    spin_lock(&cache->lock);
+    empty = cache->depot_empty;
+    if (empty) {
+        cache->depot_empty = empty->next;
+        cache->depot_empty_count--;
+    } else {
+        // Magazines come from an unmagazined cache, so this cannot recurse
+        spin_unlock(&cache->lock);
+        empty = kmem_cache_alloc(magazine_cache);
+        spin_lock(&cache->lock);
+        if (empty) empty->rounds = 0;
+    }
+
+    if (!empty) {
+        slab_free(cache, obj);
+    } else {
+        if (cc->previous) {
+            cc->previous->next = cache->depot_full;
+            cache->depot_full = cc->previous;
+            cache->depot_full_count++;
+        }
+        cc->previous = cc->loaded;
+        cc->loaded = empty;
+        empty->objs[empty->rounds++] = obj;
+    }
+    spin_unlock(&cache->lock);
+}
+
+__hot void kmem_cache_free(struct kmem_cache* cache, void* obj) {
+    unsigned long flags = irq_save();
+    struct kmem_cpu_cache* cc = &cache->cpu[cpu_id()];
+    struct kmem_magazine* mag;
+
+    if (cache->flags & KMEM_NO_MAGAZINES) {
+        spin_lock(&cache->lock);
+        slab_free(cache, obj);
+        spin_unlock(&cache->lock);
+    } else if ((mag = cc->loaded) && mag->rounds < MAGAZINE_SIZE) {
+        mag->objs[mag->rounds++] = obj;
+        cc->hits++;
+    } else if ((mag = cc->previous) && mag->rounds == 0) {
+        cc->previous = cc->loaded;
+        cc->loaded = mag;
+        mag->objs[mag->rounds++] = obj;
+        cc->hits++;
+    } else {
+        kmem_cache_free_slow(cache, cc, obj);
+    }
+
+    irq_restore(flags);
+}
+
+// Shrinker: the depot's full magazines go back to the slab layer, empty
+// magazines to the magazine cache, and empty slabs to the frame allocator.
+// Called from inside allocations, so busy caches are skipped, not waited on.
+static uint32_t kmem_shrink_count(void) {
+    uint32_t count = 0;
+
+    for (uint32_t i = 0; i < cache_count; i++) {
+        count += cache_pool[i].depot_full_count * MAGAZINE_SIZE + cache_pool[i].depot_empty_count;
+    }
+    return count;
+}
+
+static int magazine_release(struct kmem_magazine* mag) {
+    if (!spin_trylock(&magazine_cache->lock)) return 0;
+    slab_free(magazine_cache, mag);
+    spin_unlock(&magazine_cache->lock);
+    return 1;
+}
+
+static uint32_t kmem_shrink_scan(uint32_t nr) {
+    uint32_t freed = 0;
+    unsigned long flags = irq_save();
+
+    for (uint32_t i = 0; i < cache_count && freed < nr; i++) {
+        struct kmem_cache* cache = &cache_pool[i];
+        if (!spin_trylock(&cache->lock)) continue;
+
+        while (cache->depot_full && freed < nr) {
+            struct kmem_magazine* mag = cache->depot_full;
+            cache->depot_full = mag->next;
+            cache->depot_full_count--;
+            while (mag->rounds) {
+                slab_free(cache, mag->objs[--mag->rounds]);
+                freed++;
+            }
+            mag->next = cache->depot_empty;
+            cache->depot_empty = mag;
+            cache->depot_empty_count++;
+        }
+        while (cache->depot_empty && freed < nr) {
+            struct kmem_magazine* mag = cache->depot_empty;
+            struct kmem_magazine* next = mag->next;
+            if (!magazine_release(mag)) break;
+            cache->depot_empty = next;
+            cache->depot_empty_count--;
+            freed++;
+        }
+
+        // The slab layer keeps one empty slab; let it go too
+        for (struct slab* slab = cache->partial, *next; slab; slab = next) {
+            next = slab->next;
+            if (slab->inuse == 0) {
+                slab_unlink(cache, slab);
+                cache->slabs--;
+                pmm_free_frame(virt_to_phys(slab));
+            }
+        }
+        spin_unlock(&cache->lock);
+    }
+
+    irq_restore(flags);
+    return freed;
+}
+
+static struct shrinker kmem_shrinker = {
+    "slab", kmem_shrink_count, kmem_shrink_scan, 0, 0
+};
+
+void* kmalloc(size_t size) {
+    for (uint32_t i = 0; i < sizeof(kmalloc_sizes) / sizeof(kmalloc_sizes[0]); i++) {
+        if (size <= kmalloc_sizes[i]) {
+            return kmalloc_caches[i] ? kmem_cache_alloc(kmalloc_caches[i]) : 0;
+        }
+    }
+    return 0;
+}
+
+void kfree(void* ptr) {
+    if (ptr) kmem_cache_free(slab_of(ptr)->cache, ptr);
+}
+
+__cold void kmem_init(void) {
+    magazine_cache = kmem_cache_create_flags("magazine", sizeof(struct kmem_magazine),
+                                             KMEM_NO_MAGAZINES);
+    for (uint32_t i = 0; i < sizeof(kmalloc_sizes) / sizeof(kmalloc_sizes[0]); i++) {
+        kmalloc_caches[i] = kmem_cache_create(kmalloc_names[i], kmalloc_sizes[i]);
+    }
+    register_shrinker(&kmem_shrinker);
+}
+
+void kmem_report(void) {
+    terminal_writestring("cache          size  inuse  slabs  depot  hit%\n");
+    for (uint32_t i = 0; i < cache_count; i++) {
+        struct kmem_cache* cache = &cache_pool[i];
+        uint32_t hits = 0, total = 0;
+
+        for (uint32_t cpu = 0; cpu < NR_CPUS; cpu++) {
+            hits += cache->cpu[cpu].hits;
+            total += cache->cpu[cpu].hits + cache->cpu[cpu].misses;
+        }
+
+        terminal_writestring(cache->name);
+        for (int pad = str_len(cache->name); pad < 14; pad++) terminal_putchar(' ');
+        terminal_writedec(cache->size);
+        terminal_writestring("  ");
+        terminal_writedec(cache->inuse);
+        terminal_writestring("  ");
+        terminal_writedec(cache->slabs);
+        terminal_writestring("  ");
+        terminal_writedec(cache->depot_full_count);
+        terminal_putchar('/');
+        terminal_writedec(cache->depot_empty_count);
+        terminal_writestring("  ");
+        terminal_writedec(total ? (uint32_t)div64_u32((uint64_t)hits * 100, total) : 0);
+        terminal_putchar('\n');
+    }
+}
@@ -0,0 +1,195 @@
+// softirq.c - Deferred interrupt work
+//
+// Interrupt handlers (the top half) should only note what happened and
+// raise a softirq; the work itself runs afterwards with interrupts enabled.
+// Pending softirqs are a per-CPU bitmap, run by irq_exit() when the
+// outermost interrupt returns. If they keep getting raised while they run,
+// the rest is left to the ksoftirqd thread so interrupt returns stay short
+// and threads still get the CPU.
+//
+// Tasklets are the usual way in: a handler queues a struct tasklet and its
+// function runs from SOFTIRQ_HI or SOFTIRQ_TASKLET. A tasklet is queued at
+// most once however often it is scheduled before it runs.
+
+#include "kernel.h"
+
+#define SOFTIRQ_RESTART_MAX 10
+
+struct softirq_cpu {
+    volatile uint32_t pending;
+    uint32_t irq_depth;                 // Nested interrupt handlers
+    uint32_t in_softirq;
+    struct tasklet* head[2];            // SOFTIRQ_HI and SOFTIRQ_TASKLET
+    struct tasklet** tail[2];           // 0 while the list is empty
+} __attribute__((aligned(64)));
+
+static void tasklet_hi_action(void);
+static void tasklet_action(void);
+
+static struct softirq_cpu softirq_cpus[NR_CPUS];
+static void (*softirq_handlers[NR_SOFTIRQS])(void) = {
+    tasklet_hi_action, tasklet_action, rcu_process_callbacks
+};
+static const char* const softirq_names[NR_SOFTIRQS] = { "HI", "TASKLET", "RCU" };
+static uint32_t softirq_runs[NR_SOFTIRQS];
+static uint32_t softirq_deferred;       // Rounds left to ksoftirqd
+static struct thread* ksoftirqd;
+
+void open_softirq(enum softirq_nr nr, void (*handler)(void)) {
+    softirq_handlers[nr] = handler;
+}
+
+// Outside interrupt context nothing would run the softirq until the next
+// interrupt returns, so ksoftirqd is woken instead
+void raise_softirq(enum softirq_nr nr) {
+    unsigned long flags = irq_save();
+    struct softirq_cpu* c = &softirq_cpus[cpu_id()];
+
+    c->pending |= 1u << nr;
+    if (!c->irq_depth && !c->in_softirq && ksoftirqd) {
+        thread_wake(ksoftirqd);
+    }
+    irq_restore(flags);
+}
+
+void tasklet_init(struct tasklet* t, void (*func)(void*), void* arg) {
+    t->next = 0;
+    t->func = func;
+    t->arg = arg;
+    t->state = 0;
+}
+
+static void tasklet_queue(struct tasklet* t, enum softirq_nr nr) {
+    unsigned long flags = irq_save();
+    struct softirq_cpu* c = &softirq_cpus[cpu_id()];
+
+    if (!(t->state & TASKLET_SCHEDULED)) {
+        t->state |= TASKLET_SCHEDULED;
+        t->next = 0;
+        if (c->tail[nr]) *c->tail[nr] = t;
+        else c->head[nr] = t;
+        c->tail[nr] = &t->next;
+        raise_softirq(nr);
+    }
+    irq_restore(flags);
+}
+
+void tasklet_schedule(struct tasklet* t) {
+    tasklet_queue(t, SOFTIRQ_TASKLET);
+}
+
+void tasklet_hi_schedule(struct tasklet* t) {
+    tasklet_queue(t, SOFTIRQ_HI);
+}
+
+// Take the whole list with interrupts off, then run it with them on. The
+// state bit is cleared first so a tasklet may schedule itself again.
+static void tasklet_run(enum softirq_nr nr) {
+    unsigned long flags = irq_save();
+    struct softirq_cpu* c = &softirq_cpus[cpu_id()];
+    struct tasklet* list = c->head[nr];
+
+    c->head[nr] = 0;
+    c->tail[nr] = 0;
+    irq_restore(flags);
+
+    while (list) {
+        struct tasklet* t = list;
+        list = t->next;
+        t->state &= ~TASKLET_SCHEDULED;
+        t->func(t->arg);
+    }
+}
+
+static void tasklet_hi_action(void) {
+    tasklet_run(SOFTIRQ_HI);
+}
+
+static void tasklet_action(void) {
+    tasklet_run(SOFTIRQ_TASKLET);
+}
+
+// Run pending softirqs, lowest number first, with interrupts enabled.
+// Softirqs raised meanwhile get a few more rounds before ksoftirqd takes
+// over. Never nests: an interrupt arriving during a handler only adds bits.
+void do_softirq(void) {
+    unsigned long flags = irq_save();
+    struct softirq_cpu* c = &softirq_cpus[cpu_id()];
+
+    if (c->in_softirq || !c->pending) {
+        irq_restore(flags);
+        return;
+    }
+
+    c->in_softirq = 1;
+    for (int round = 0; c->pending && round < SOFTIRQ_RESTART_MAX; round++) {
+        uint32_t pending = c->pending;
+        c->pending = 0;
+
+        asm volatile("sti");
+        for (int nr = 0; pending; nr++, pending >>= 1) {
+            if ((pending & 1) && softirq_handlers[nr]) {
+                softirq_runs[nr]++;
+                softirq_handlers[nr]();
+            }
+        }
+        asm volatile("cli");
+    }
+    c->in_softirq = 0;
+
+    if (c->pending && ksoftirqd) {
+        softirq_deferred++;
+        thread_wake(ksoftirqd);
+    }
+    irq_restore(flags);
+}
+
+// isr_handler() brackets IRQ handlers with these; interrupts are off
+void irq_enter(void) {
+    softirq_cpus[cpu_id()].irq_depth++;
+}
+
+void irq_exit(void) {
+    struct softirq_cpu* c = &softirq_cpus[cpu_id()];
+
+    if (--c->irq_depth == 0 && c->pending && !c->in_softirq) {
+        do_softirq();
+    }
+}
+
+int in_interrupt(void) {
+    struct softirq_cpu* c = &softirq_cpus[cpu_id()];
+    return c->irq_depth || c->in_softirq;
+}
+
+static void ksoftirqd_loop(void* arg) {
+    struct softirq_cpu* c = &softirq_cpus[cpu_id()];
+
+    (void)arg;
+    while (1) {
+        unsigned long flags = irq_save();
+        if (!c->pending) thread_block();
+        irq_restore(flags);
+
+        do_softirq();
+        thread_yield();
+    }
+}
+
+// Until this runs, softirqs raised outside interrupts wait for the next one
+__cold void softirq_init(void) {
+    ksoftirqd = thread_create("ksoftirqd", ksoftirqd_loop, 0);
+}
+
+void softirq_report(void) {
+    for (int nr = 0; nr < NR_SOFTIRQS; nr++) {
+        terminal_writestring("  ");
+        terminal_writestring(softirq_names[nr]);
+        terminal_writestring(": ");
+        terminal_writedec(softirq_runs[nr]);
+        terminal_writestring(" runs\n");
+    }
+    terminal_writestring("  Deferred to ksoftirqd: ");
+    terminal_writedec(softirq_deferred);
+    terminal_writestring(" times\n");
+}
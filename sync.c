@@ -0,0 +1,164 @@
+// sync.c - Wait queues, mutexes, semaphores and condition variables
+//
+// A wait queue is a FIFO of blocked threads. Sleepers queue themselves and
+// block with interrupts off, so a wakeup from an interrupt handler cannot
+// slip in between. Woken threads recheck their condition: nothing here
+// hands a lock or count over directly, so a spurious wakeup is harmless.
+//
+// A mutex spins before sleeping only while its owner is running on another
+// CPU, where it is likely to let go soon. With one CPU the owner is never
+// running when someone else is, so contended locks always sleep.
+
+#include "kernel.h"
+
+#define MUTEX_SPIN_MAX 1000
+
+void wait_queue_init(struct wait_queue* wq) {
+    wq->head = 0;
+    wq->tail = 0;
+}
+
+// Callers have interrupts off. A thread woken some other way (or without
+// a scheduler, when blocking only waits for the next interrupt) takes
+// itself off the queue again; the run queue has its own link, so it is
+// still intact.
+void wait_queue_sleep(struct wait_queue* wq) {
+    struct thread* self = current_thread;
+    struct thread* prev = 0;
+
+    self->wait_next = 0;
+    if (wq->tail) wq->tail->wait_next = self;
+    else wq->head = self;
+    wq->tail = self;
+    thread_block();
+
+    for (struct thread* t = wq->head; t; prev = t, t = t->wait_next) {
+        if (t != self) continue;
+        if (prev) prev->wait_next = self->wait_next;
+        else wq->head = self->wait_next;
+        if (wq->tail == self) wq->tail = prev;
+        break;
+    }
+}
+
+void wake_up(struct wait_queue* wq) {
+    unsigned long flags = irq_save();
+    struct thread* t = wq->head;
+
+    if (t) {
+        wq->head = t->wait_next;
+        if (!wq->head) wq->tail = 0;
+        thread_wake(t);
+    }
+    irq_restore(flags);
+}
+
+void wake_up_all(struct wait_queue* wq) {
+    unsigned long flags = irq_save();
+    struct thread* t = wq->head;
+
+    wq->head = 0;
+    wq->tail = 0;
+    while (t) {
+        struct thread* next = t->wait_next;
+        thread_wake(t);
+        t = next;
+    }
+    irq_restore(flags);
+}
+
+// Mutexes: process context only
+void mutex_init(struct mutex* m) {
+    m->owner = 0;
+    wait_queue_init(&m->waiters);
+}
+
+void mutex_lock(struct mutex* m) {
+    unsigned long flags = irq_save();
+
+    while (m->owner) {
+        struct thread* owner = m->owner;
+        if (owner->state == THREAD_RUNNING && owner != current_thread) {
+            irq_restore(flags);
+            for (int spin = 0; spin < MUTEX_SPIN_MAX && m->owner == owner; spin++) {
+                asm volatile("pause");
+            }
+            flags = irq_save();
+            continue;
+        }
+        wait_queue_sleep(&m->waiters);
+    }
+    m->owner = current_thread;
+    irq_restore(flags);
+}
+
+int mutex_trylock(struct mutex* m) {
+    unsigned long flags = irq_save();
+    int taken = !m->owner;
+
+    if (taken) m->owner = current_thread;
+    irq_restore(flags);
+    return taken;
+}
+
+void mutex_unlock(struct mutex* m) {
+    unsigned long flags = irq_save();
+
+    m->owner = 0;
+    wake_up(&m->waiters);
+    irq_restore(flags);
+}
+
+// Counting semaphores
+void sema_init(struct semaphore* sem, uint32_t count) {
+    sem->count = count;
+    wait_queue_init(&sem->waiters);
+}
+
+void down(struct semaphore* sem) {
+    unsigned long flags = irq_save();
+
+    while (!sem->count) wait_queue_sleep(&sem->waiters);
+    sem->count--;
+    irq_restore(flags);
+}
+
+int down_trylock(struct semaphore* sem) {
+    unsigned long flags = irq_save();
+    int taken = sem->count > 0;
+
+    if (taken) sem->count--;
+    irq_restore(flags);
+    return taken;
+}
+
+void up(struct semaphore* sem) {
+    unsigned long flags = irq_save();
+
+    sem->count++;
+    wake_up(&sem->waiters);
+    irq_restore(flags);
+}
+
+// Condition variables. cond_wait() drops the mutex and sleeps as one step,
+// then takes the mutex again; callers recheck their condition in a loop.
+void cond_init(struct condvar* cv) {
+    wait_queue_init(&cv->waiters);
+}
+
+void cond_wait(struct condvar* cv, struct mutex* m) {
+    unsigned long flags = irq_save();
+
+    mutex_unlock(m);
+    wait_queue_sleep(&cv->waiters);
+    irq_restore(flags);
+    mutex_lock(m);
+}
+
+void cond_signal(struct condvar* cv) {
+    wake_up(&cv->waiters);
+}
+
+void cond_broadcast(struct condvar* cv) {
+    wake_up_all(&cv->waiters);
+}
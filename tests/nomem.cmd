@@ -0,0 +1,5 @@
+echo nomem test
+set greeting hello
+echo $greeting from COM1
+time
+exit
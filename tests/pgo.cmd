@@ -0,0 +1,13 @@
+# Training run for "make pgo": exercise the shell dispatch, console and
+# interrupt paths, then export the counters
+help
+sysinfo
+sysctl
+sysctl hz=1000
+echo profile training run
+time
+selftest
+bench
+sysctl hz=100
+gcov
+exit 0
@@ -0,0 +1,37 @@
+echo smoke test
+sysinfo
+meminfo
+slabinfo
+numastat
+threads
+threads | wc
+help | grep pipe
+sysinfo | head 3
+echo saved > /tmp/smoke
+threads >> /tmp/smoke
+ls
+cat /tmp/smoke | head 2
+rm /tmp/smoke
+set greeting hello
+echo $greeting from a script
+repeat 2 i
+  echo loop $i
+end
+echo repeat 2 n > /tmp/loop
+echo echo pass \$n >> /tmp/loop
+echo end >> /tmp/loop
+run /tmp/loop
+time threads | wc
+softirqs
+workqueues
+rcu
+bg echo from a worker
+prof start
+backtrace
+sysctl
+sysctl hz=250
+sysctl console=both
+time
+selftest
+prof stop
+exit
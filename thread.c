@@ -0,0 +1,357 @@
+// thread.c - Kernel threads and the kernel stack pool
+//
+// Threads are cooperative: one runs until it yields, blocks or exits, and
+// schedule() hands the CPU to the next thread on a FIFO run queue. The
+// idle thread runs when nothing else is ready. Interrupts stay disabled
+// from the moment schedule() picks a thread until the switch completes.
+//
+// Stacks come from a dedicated virtual region (KSTACK_REGION_BASE). Each
+// slot is an unmapped guard page followed by KSTACK_SIZE of mapped stack,
+// so running off the end faults instead of corrupting a neighbour. Stacks
+// of exited threads stay mapped on a free list and are reused as they are;
+// the pool's shrinker gives cached stacks back under memory pressure.
+
+#include "kernel.h"
+
+#define KSTACK_SLOT_SIZE (PAGE_SIZE + KSTACK_SIZE)
+
+enum kstack_slot_state {
+    KSTACK_UNMAPPED = 0,
+    KSTACK_IN_USE,
+    KSTACK_CACHED
+};
+
+extern char stack_bottom[];
+void switch_context(uintptr_t* old_sp, uintptr_t new_sp);
+
+// Stack pool
+static spinlock_t kstack_lock;
+static uint8_t kstack_state[KSTACK_SLOTS];
+static uint32_t kstack_cache[KSTACK_SLOTS];     // Slots with mapped, unused stacks
+static uint32_t kstack_cached = 0;
+static uint32_t kstack_fresh = 0;               // Stacks that needed new frames
+static uint32_t kstack_reused = 0;
+
+// Threads
+static struct kmem_cache* thread_cache = 0;
+static struct thread boot_thread = {
+    .name = "boot",
+    .state = THREAD_RUNNING,
+    .stack = (uintptr_t)stack_bottom,
+};
+static struct thread* idle_thread = 0;
+static struct thread* run_head = 0;
+static struct thread* run_tail = 0;
+static struct thread* zombies = 0;
+static struct thread* all_threads = 0;
+static uint32_t next_tid = 0;
+static uint32_t context_switches = 0;
+struct thread* current_thread = &boot_thread;
+
+static inline uintptr_t kstack_base(uint32_t slot) {
+    return KSTACK_REGION_BASE + (uintptr_t)slot * KSTACK_SLOT_SIZE + PAGE_SIZE;
+}
+
+static void kstack_unmap(uint32_t slot) {
+    for (uint32_t off = 0; off < KSTACK_SIZE; off += PAGE_SIZE) {
+        phys_addr_t frame = paging_unmap_page(kstack_base(slot) + off);
+        if (frame) pmm_free_frame(frame);
+    }
+}
+
+static int kstack_map(uint32_t slot) {
+    for (uint32_t off = 0; off < KSTACK_SIZE; off += PAGE_SIZE) {
+        phys_addr_t frame = pmm_alloc_frame();
+        if (!frame || !paging_map_page(kstack_base(slot) + off, frame)) {
+            if (frame) pmm_free_frame(frame);
+            kstack_unmap(slot);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Returns the lowest address of a KSTACK_SIZE stack, or 0
+static uintptr_t kstack_alloc(void) {
+    unsigned long flags = spin_lock_irqsave(&kstack_lock);
+    uint32_t slot;
+
+    if (kstack_cached) {
+        slot = kstack_cache[--kstack_cached];
+        kstack_state[slot] = KSTACK_IN_USE;
+        kstack_reused++;
+        spin_unlock_irqrestore(&kstack_lock, flags);
+        return kstack_base(slot);
+    }
+
+    for (slot = 0; slot < KSTACK_SLOTS && kstack_state[slot] != KSTACK_UNMAPPED; slot++) {
+    }
+    if (slot == KSTACK_SLOTS) {
+        spin_unlock_irqrestore(&kstack_lock, flags);
+        return 0;
+    }
+    kstack_state[slot] = KSTACK_IN_USE;
+    spin_unlock_irqrestore(&kstack_lock, flags);
+
+    if (!kstack_map(slot)) {
+        kstack_state[slot] = KSTACK_UNMAPPED;
+        return 0;
+    }
+    kstack_fresh++;
+    return kstack_base(slot);
+}
+
+static void kstack_free(uintptr_t base) {
+    uint32_t slot = (uint32_t)((base - KSTACK_REGION_BASE) / KSTACK_SLOT_SIZE);
+    unsigned long flags = spin_lock_irqsave(&kstack_lock);
+
+    kstack_state[slot] = KSTACK_CACHED;
+    kstack_cache[kstack_cached++] = slot;
+    spin_unlock_irqrestore(&kstack_lock, flags);
+}
+
+static uint32_t kstack_shrink_count(void) {
+    return kstack_cached;
+}
+
+static uint32_t kstack_shrink_scan(uint32_t nr) {
+    uint32_t freed = 0;
+
+    if (!spin_trylock(&kstack_lock)) return 0;
+    while (kstack_cached && freed < nr) {
+        uint32_t slot = kstack_cache[--kstack_cached];
+        kstack_unmap(slot);
+        kstack_state[slot] = KSTACK_UNMAPPED;
+        freed++;
+    }
+    spin_unlock(&kstack_lock);
+    return freed;
+}
+
+static struct shrinker kstack_shrinker = {
+    "kstack", kstack_shrink_count, kstack_shrink_scan, 0, 0
+};
+
+// Run queue; callers hold interrupts off
+static void runqueue_push(struct thread* t) {
+    t->next = 0;
+    if (run_tail) run_tail->next = t;
+    else run_head = t;
+    run_tail = t;
+}
+
+static struct thread* runqueue_pop(void) {
+    struct thread* t = run_head;
+
+    if (t) {
+        run_head = t->next;
+        if (!run_head) run_tail = 0;
+    }
+    return t;
+}
+
+// Switch to the next ready thread. A running caller goes to the back of the
+// run queue; a blocked or dead one does not.
+void schedule(void) {
+    unsigned long flags = irq_save();
+    struct thread* prev = current_thread;
+    struct thread* next;
+
+    rcu_note_qs();
+    if (prev->state == THREAD_RUNNING && prev != idle_thread) {
+        prev->state = THREAD_READY;
+        runqueue_push(prev);
+    }
+
+    next = runqueue_pop();
+    if (!next) {
+        next = prev->state == THREAD_READY || !idle_thread ? prev : idle_thread;
+    }
+
+    next->state = THREAD_RUNNING;
+    if (next != prev) {
+        context_switches++;
+        current_thread = next;
+        switch_context(&prev->sp, next->sp);
+    }
+    irq_restore(flags);
+}
+
+void thread_yield(void) {
+    if (run_head) schedule();
+}
+
+// Callers set up whatever will wake them with interrupts off, so a wakeup
+// cannot slip in before the block. Without a scheduler (booted without a
+// memory map) there is nothing to switch to, so this halts until the next
+// interrupt instead; callers recheck their condition either way.
+void thread_block(void) {
+    unsigned long flags = irq_save();
+    if (!idle_thread && !run_head) {
+        asm volatile("sti; hlt; cli" ::: "memory");
+    } else {
+        current_thread->state = THREAD_BLOCKED;
+        schedule();
+    }
+    irq_restore(flags);
+}
+
+void thread_wake(struct thread* t) {
+    unsigned long flags = irq_save();
+    if (t->state == THREAD_BLOCKED) {
+        t->state = THREAD_READY;
+        runqueue_push(t);
+    }
+    irq_restore(flags);
+}
+
+// Free exited threads; never the current one, whose stack is still in use
+static void thread_reap(void) {
+    unsigned long flags = irq_save();
+    struct thread* list = zombies;
+    zombies = 0;
+    irq_restore(flags);
+
+    while (list) {
+        struct thread* t = list;
+        list = t->next;
+
+        flags = irq_save();
+        for (struct thread** p = &all_threads; *p; p = &(*p)->all_next) {
+            if (*p == t) {
+                *p = t->all_next;
+                break;
+            }
+        }
+        irq_restore(flags);
+
+        kstack_free(t->stack);
+        kmem_cache_free(thread_cache, t);
+    }
+}
+
+__attribute__((noreturn)) void thread_exit(void) {
+    irq_save();
+    current_thread->state = THREAD_DEAD;
+    current_thread->next = zombies;
+    zombies = current_thread;
+    schedule();
+    __builtin_unreachable();
+}
+
+// First code a new thread runs, entered through switch_context()'s ret
+static void thread_start(void) {
+    struct thread* t = current_thread;
+
+    asm volatile("sti");
+    t->entry(t->arg);
+    thread_exit();
+}
+
+struct thread* thread_create(const char* name, void (*entry)(void*), void* arg) {
+    thread_reap();
+
+    struct thread* t = kmem_cache_alloc(thread_cache);
+    if (!t) return 0;
+
+    t->stack = kstack_alloc();
+    if (!t->stack) {
+        kmem_cache_free(thread_cache, t);
+        return 0;
+    }
+
+    t->name = name;
+    t->entry = entry;
+    t->arg = arg;
+    t->in = 0;
+    t->out = 0;
+
+    // Frame for switch_context(): callee-saved registers, then thread_start
+    // as the return address and a zero return address for thread_start
+    // itself, leaving the ABI's stack alignment at its entry
+    uintptr_t* sp = (uintptr_t*)(t->stack + KSTACK_SIZE);
+    *--sp = 0;
+    *--sp = (uintptr_t)thread_start;
+#ifdef __x86_64__
+    for (int i = 0; i < 6; i++) *--sp = 0;
+#else
+    for (int i = 0; i < 4; i++) *--sp = 0;
+#endif
+    t->sp = (uintptr_t)sp;
+
+    unsigned long flags = irq_save();
+    t->id = ++next_tid;
+    t->all_next = all_threads;
+    all_threads = t;
+    if (entry) {
+        t->state = THREAD_READY;
+        runqueue_push(t);
+    } else {
+        t->state = THREAD_BLOCKED;
+    }
+    irq_restore(flags);
+    return t;
+}
+
+static void idle_loop(void* arg) {
+    (void)arg;
+    while (1) {
+        thread_reap();
+        rcu_note_qs();
+        // Wakeups come from interrupt handlers. With interrupts off from
+        // the check on, one arriving after it is held until the hlt,
+        // which it then ends: sti takes effect one instruction late.
+        asm volatile("cli" ::: "memory");
+        if (run_head) {
+            schedule();
+            asm volatile("sti");
+        } else {
+            asm volatile("sti; hlt" ::: "memory");
+        }
+    }
+}
+
+// The boot stack becomes thread 0, which goes on to run the shell
+__cold void sched_init(void) {
+    boot_thread.name = "shell";
+    all_threads = &boot_thread;
+
+    thread_cache = kmem_cache_create("thread", sizeof(struct thread));
+    register_shrinker(&kstack_shrinker);
+
+    // The idle thread is never queued; schedule() falls back to it
+    idle_thread = thread_create("idle", 0, 0);
+    if (idle_thread) {
+        idle_thread->entry = idle_loop;
+        idle_thread->state = THREAD_READY;
+    }
+}
+
+static const char* const thread_state_names[] = { "ready", "running", "blocked", "dead" };
+
+void thread_report(void) {
+    terminal_writestring("tid  state    stack               name\n");
+    for (struct thread* t = all_threads; t; t = t->all_next) {
+        terminal_writedec(t->id);
+        terminal_writestring("    ");
+        terminal_writestring(thread_state_names[t->state]);
+        for (int pad = str_len(thread_state_names[t->state]); pad < 9; pad++) terminal_putchar(' ');
+        terminal_writehex(t->stack);
+        terminal_writestring("  ");
+        terminal_writestring(t->name);
+        terminal_putchar('\n');
+    }
+    terminal_writestring("Stacks: ");
+    terminal_writedec(kstack_fresh);
+    terminal_writestring(" mapped, ");
+    terminal_writedec(kstack_reused);
+    terminal_writestring(" reused, ");
+    terminal_writedec(kstack_cached);
+    terminal_writestring(" cached; ");
+    terminal_writedec(context_switches);
+    terminal_writestring(" context switches\n");
+}
+
+uint32_t kstack_reuse_count(void) {
+    return kstack_reused;
+}
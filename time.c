@@ -0,0 +1,88 @@
+// time.c - Timekeeping
+//
+// Kernel time is base_ns at the last timer tick plus the TSC cycles since
+// then, converted with ns = cycles * mult >> shift. The tick handler moves
+// the base forward in a few stores under a seqlock; readers never write
+// shared data and simply retry if a tick lands mid-read.
+//
+// The TSC rate is measured against PIT channel 2 at boot. Without a usable
+// TSC, mult is 0 and time advances by one tick period per tick. The state
+// lives in the vDSO data page, so user code can read time the same way.
+
+#include "kernel.h"
+
+#define PIT_FREQUENCY 1193182
+#define PIT_CHANNEL2 0x42
+#define PIT_COMMAND 0x43
+#define PIT_GATE_PORT 0x61              // Bit 0 gates channel 2, bit 5 is its output
+
+#define CALIBRATE_MS 10
+#define TIME_SHIFT 22
+#define NSEC_PER_MSEC 1000000
+
+static struct vdso_data* const tk = &vdso_page.data;
+uint32_t tsc_khz = 0;
+
+// Count TSC cycles across CALIBRATE_MS of PIT channel 2 counting down in
+// mode 0. Returns 0 if there is no TSC or the PIT never finishes.
+static __cold uint32_t tsc_calibrate(void) {
+    uint32_t a, b, c, d;
+    uint32_t latch = PIT_FREQUENCY / (1000 / CALIBRATE_MS);
+    uint64_t start, cycles;
+    uint32_t spins = 0;
+
+    cpuid(1, &a, &b, &c, &d);
+    if (!(d & (1u << 4))) return 0;
+
+    outb(PIT_GATE_PORT, (inb(PIT_GATE_PORT) & ~0x02) | 0x01);   // Gate on, speaker off
+    outb(PIT_COMMAND, 0xB0);            // Channel 2, lo/hi byte, mode 0
+    outb(PIT_CHANNEL2, latch & 0xFF);
+    outb(PIT_CHANNEL2, (latch >> 8) & 0xFF);
+
+    start = rdtsc();
+    while (!(inb(PIT_GATE_PORT) & 0x20)) {
+        if (++spins > 10000000) return 0;
+    }
+    cycles = rdtsc() - start;
+
+    return (uint32_t)div64_u32(cycles, CALIBRATE_MS);
+}
+
+// Timer interrupt: move the base to now in a few stores
+__hot void timekeeping_tick(void) {
+    uint64_t tsc = tk->mult ? rdtsc() : 0;
+    uint64_t now = tk->base_ns + (((tsc - tk->base_tsc) * tk->mult) >> tk->shift);
+
+    write_seqlock(&tk->lock);
+    tk->base_ns = tk->mult ? now : now + tk->tick_ns;
+    tk->base_tsc = tsc;
+    write_sequnlock(&tk->lock);
+}
+
+// Called with interrupts off whenever the timer is reprogrammed
+void timekeeping_set_hz(uint32_t hz) {
+    write_seqlock(&tk->lock);
+    tk->tick_ns = 1000000000u / hz;
+    write_sequnlock(&tk->lock);
+}
+
+__cold void timekeeping_init(void) {
+    tsc_khz = tsc_calibrate();
+
+    write_seqlock(&tk->lock);
+    tk->shift = TIME_SHIFT;
+    if (tsc_khz) {
+        tk->mult = (uint32_t)div64_u32((uint64_t)NSEC_PER_MSEC << TIME_SHIFT, tsc_khz);
+        tk->base_tsc = rdtsc();
+    }
+    write_sequnlock(&tk->lock);
+}
+
+// Nanoseconds since timekeeping_init(); lock-free
+uint64_t ktime_ns(void) {
+    return vdso_read_ns(tk);
+}
+
+uint32_t uptime_ms() {
+    return (uint32_t)div64_u32(ktime_ns(), NSEC_PER_MSEC);
+}
@@ -0,0 +1,29 @@
+#!/bin/sh
+# gcov-extract.sh - Recreate .gcda files from a kernel's "gcov" output
+#
+# Usage: gcov-extract.sh <log>
+#
+# The instrumented kernel prints each object's counters as
+#   GCOV-FILE <path of the .gcda file>
+#   <hex bytes>...
+#   GCOV-END
+# on COM1 (see gcov.c). Every block is decoded back into binary at <path>,
+# which is where gcc -fprofile-use looks for it.
+
+if [ $# -ne 1 ]; then
+    echo "Usage: $0 <log>" >&2
+    exit 2
+fi
+
+tr -d '\r' < "$1" | awk '
+    $1 == "GCOV-FILE" { out = "xxd -r -p > \"" $2 "\""; files++; next }
+    $1 == "GCOV-END"  { close(out); out = ""; next }
+    out != ""         { print | out }
+    END {
+        if (!files) {
+            print "gcov-extract: no profiles found" > "/dev/stderr"
+            exit 1
+        }
+        printf "gcov-extract: wrote %d .gcda files\n", files
+    }
+'
@@ -0,0 +1,40 @@
+#!/bin/sh
+# gensyms.sh - Build the kernel symbol table from "nm -n" output
+#
+# Usage: nm -n kernel.tmp | gensyms.sh > ksyms.c
+#        gensyms.sh < /dev/null > ksyms0.c        (empty table)
+#
+# Text symbols come out sorted by address, as nm -n lists them, so the
+# kernel can symbolize with a binary search (unwind.c). Names are packed
+# into one string and found through offsets. The image is linked at 1 MiB
+# on both architectures, so 32 bits hold any text address.
+
+awk '
+    BEGIN { n = 0 }
+    NF == 3 && $2 ~ /^[tTwW]$/ && $3 !~ /^\./ {
+        addr[n] = substr($1, length($1) - 7)
+        name[n] = $3
+        n++
+    }
+    END {
+        print "// Generated by tools/gensyms.sh - do not edit"
+        print "#include <stdint.h>"
+        print ""
+        print "const uint32_t ksym_count = " n ";"
+        print ""
+        print "const uint32_t ksym_addrs[] = {"
+        for (i = 0; i < n; i++) print "    0x" addr[i] ","
+        if (n == 0) print "    0"
+        print "};"
+        print ""
+        print "const uint32_t ksym_offsets[] = {"
+        off = 0
+        for (i = 0; i < n; i++) { print "    " off ","; off += length(name[i]) + 1 }
+        if (n == 0) print "    0"
+        print "};"
+        print ""
+        print "const char ksym_names[] ="
+        for (i = 0; i < n; i++) print "    \"" name[i] "\\0\""
+        print "    \"\";"
+    }
+'
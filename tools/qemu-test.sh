@@ -0,0 +1,69 @@
+#!/bin/sh
+# qemu-test.sh - Run the kernel headless and turn the result into an exit code
+#
+# Usage: qemu-test.sh <commands> <log> -- <qemu command line...>
+#
+# The shell commands in <commands> are fed to COM1 (pass /dev/null when they
+# are loaded as a multiboot module instead), everything the kernel prints on
+# COM1 is captured in <log>. The guest reports its result through
+# the isa-debug-exit device: writing N to it makes QEMU exit with (N << 1) | 1,
+# so status 1 means the guest asked to exit with code 0.
+#
+# Environment:
+#   TEST_TIMEOUT     seconds before the run counts as hung (default 60)
+#   BENCH_BASELINE   previous log to compare BENCH lines against
+#   BENCH_TOLERANCE  allowed slowdown in percent (default 20)
+
+if [ $# -lt 4 ] || [ "$3" != "--" ]; then
+    echo "Usage: $0 <commands> <log> -- <qemu command line...>" >&2
+    exit 2
+fi
+
+commands=$1
+log=$2
+shift 3
+
+timeout=${TEST_TIMEOUT:-60}
+tolerance=${BENCH_TOLERANCE:-20}
+
+# Leading blank lines are ignored by the shell; they absorb any byte the
+# UART drops while the kernel programs it.
+{ printf '\n\n'; cat "$commands"; } | timeout "$timeout" "$@" > "$log" 2>&1
+status=$?
+
+case $status in
+1)
+    ;;
+124)
+    echo "FAIL: timed out after ${timeout}s (see $log)" >&2
+    exit 1
+    ;;
+*)
+    if [ $((status & 1)) -eq 1 ]; then
+        echo "FAIL: kernel exited with code $((status >> 1)) (see $log)" >&2
+    else
+        echo "FAIL: qemu exited with status $status (see $log)" >&2
+    fi
+    exit 1
+    ;;
+esac
+
+if [ -n "$BENCH_BASELINE" ]; then
+    awk -v tol="$tolerance" '
+        FNR == NR && $1 == "BENCH" { base[$2] = $3; next }
+        $1 == "BENCH" && ($2 in base) && base[$2] > 0 {
+            delta = ($3 - base[$2]) * 100 / base[$2]
+            printf "%-12s %10d -> %10d cycles/op (%+.1f%%)\n", $2, base[$2], $3, delta
+            if (delta > tol) { regressed++ }
+        }
+        END {
+            if (regressed) {
+                printf "FAIL: %d benchmark(s) regressed by more than %d%%\n", regressed, tol
+                exit 1
+            }
+        }
+    ' "$BENCH_BASELINE" "$log" || exit 1
+fi
+
+echo "PASS (see $log)"
+exit 0
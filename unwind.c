@@ -0,0 +1,99 @@
+// unwind.c - Stack unwinding and kernel symbolization
+//
+// The symbol table (ksym_*) is generated at build time from the first link
+// of the kernel (tools/gensyms.sh) and linked into the second: text
+// addresses sorted ascending, with names packed into one string. Lookups
+// are a binary search, cheap enough for the profiler to run per sample.
+//
+// The unwinder follows saved frame pointers. Frames are only trusted while
+// they stay inside the current thread's stack, so a build without
+// FRAME_POINTERS=1 gives short traces rather than faults.
+
+#include "kernel.h"
+
+extern const uint32_t ksym_count;
+extern const uint32_t ksym_addrs[];
+extern const uint32_t ksym_offsets[];
+extern const char ksym_names[];
+extern char _text_end[];
+
+// Index of the symbol containing addr, or -1 outside the kernel's text
+int ksym_index(uintptr_t addr) {
+    uint32_t low = 0, high = ksym_count;
+
+    if (!ksym_count || addr < ksym_addrs[0] || addr >= (uintptr_t)_text_end) {
+        return -1;
+    }
+    // Last entry with an address <= addr
+    while (high - low > 1) {
+        uint32_t mid = low + (high - low) / 2;
+        if (ksym_addrs[mid] <= addr) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+    return (int)low;
+}
+
+const char* ksym_name(int index) {
+    return ksym_names + ksym_offsets[index];
+}
+
+const char* ksym_lookup(uintptr_t addr, uintptr_t* offset) {
+    int index = ksym_index(addr);
+
+    if (index < 0) return 0;
+    if (offset) *offset = addr - ksym_addrs[index];
+    return ksym_name(index);
+}
+
+// "  0x00101234 name+0x1c". A return address can sit just past a call to a
+// noreturn function at the end of its caller, so it is looked up one byte
+// earlier and the offset corrected back.
+static void frame_print(uintptr_t addr, int is_return) {
+    uintptr_t offset = 0;
+    const char* name = ksym_lookup(addr - is_return, &offset);
+
+    terminal_writestring("  ");
+    terminal_writehex(addr);
+    if (name) {
+        terminal_writestring(" ");
+        terminal_writestring(name);
+        terminal_writestring("+");
+        terminal_writehex(offset + is_return);
+    }
+    terminal_putchar('\n');
+}
+
+// Return addresses of up to max callers, starting from frame pointer bp
+int unwind_stack(uintptr_t bp, uintptr_t* pcs, int max) {
+    uintptr_t low = current_thread->stack;
+    uintptr_t high = low + KSTACK_SIZE;
+    int depth = 0;
+
+    while (depth < max) {
+        if (bp < low || bp + 2 * sizeof(uintptr_t) > high || (bp & (sizeof(uintptr_t) - 1))) {
+            break;
+        }
+        uintptr_t* frame = (uintptr_t*)bp;
+        if (!frame[1]) break;
+
+        pcs[depth++] = frame[1];
+        if (frame[0] <= bp) break;
+        bp = frame[0];
+    }
+    return depth;
+}
+
+// The faulting pc, then its callers
+void backtrace_print(uintptr_t pc, uintptr_t bp) {
+    uintptr_t pcs[16];
+    int depth = unwind_stack(bp, pcs, 16);
+
+    terminal_writestring("Backtrace:\n");
+    frame_print(pc, 0);
+    for (int i = 0; i < depth; i++) {
+        frame_print(pcs[i], 1);
+    }
+}
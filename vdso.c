@@ -0,0 +1,36 @@
+// vdso.c - Time page readable without entering the kernel
+//
+// The timekeeper (time.c) keeps its state in vdso_page, a page of its own.
+// vdso_init() maps that page read-only and user-accessible at VDSO_BASE,
+// with the code page holding vdso_time_ns() right after it. That function
+// only reads the data page through VDSO_BASE and executes rdtsc, so code
+// running at any privilege level can call it through the mapping and get
+// the same nanoseconds as ktime_ns() without a system call.
+//
+// There is no user mode yet; the shell's selftest and bench call through
+// the mapping from the kernel.
+
+#include "kernel.h"
+
+union vdso_page vdso_page __attribute__((aligned(PAGE_SIZE)));
+int vdso_mapped = 0;
+
+// Linked into the .vdso section (linker.ld). Must not call anything or
+// touch kernel data: everything it uses is inlined or at VDSO_BASE.
+__attribute__((section(".vdso_text"), used, noinline, no_profile_instrument_function))
+uint64_t vdso_time_ns(void) {
+    return vdso_read_ns((const struct vdso_data*)VDSO_BASE);
+}
+
+__cold void vdso_init(void) {
+    vdso_mapped = paging_map_user_page(VDSO_BASE, virt_to_phys(&vdso_page), 0) &&
+                  paging_map_user_page(VDSO_BASE + PAGE_SIZE, virt_to_phys(__vdso_text_start),
+                                       PROT_EXEC);
+}
+
+// Where vdso_time_ns() appears through the mapping, or 0 if not mapped
+vdso_time_fn vdso_time_entry(void) {
+    if (!vdso_mapped) return 0;
+    return (vdso_time_fn)(VDSO_BASE + PAGE_SIZE +
+                          ((uintptr_t)vdso_time_ns - (uintptr_t)__vdso_text_start));
+}
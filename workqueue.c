@@ -0,0 +1,195 @@
+// workqueue.c - Work run in process context by pools of kernel threads
+//
+// queue_work() puts a struct work on the submitting CPU's queue of a
+// workqueue; one of the queue's worker threads later calls its function
+// with interrupts enabled and free to block or yield. Each workqueue has
+// max_active workers, which is also how many of its items can be in
+// progress at once. Submitting is safe from interrupt handlers and
+// softirqs; a work item is queued at most once until it starts running.
+//
+// Workers serve the queue of the CPU that created them. A work function may
+// free its struct work. flush_work() and flush_workqueue() sleep until the
+// work is done, so they must be called from a thread, never from the
+// workqueue's own workers.
+
+#include "kernel.h"
+
+#define WQ_MAX 8
+#define WQ_MAX_ACTIVE 4
+
+struct wq_cpu {
+    struct work* head;
+    struct work* tail;
+    uint32_t pending;
+    uint32_t active;
+} __attribute__((aligned(64)));
+
+struct workqueue {
+    struct wq_cpu cpu[NR_CPUS];
+    const char* name;
+    uint32_t max_active;
+    uint32_t nr_workers;
+    struct thread* workers[WQ_MAX_ACTIVE];
+    struct work* running[WQ_MAX_ACTIVE];    // What each worker is running
+    struct wait_queue more_work;            // Idle workers
+    struct wait_queue done;                 // Flushers
+    uint32_t completed;
+    uint32_t cancelled;
+};
+
+static struct workqueue wq_pool[WQ_MAX];
+static uint32_t wq_count = 0;
+struct workqueue* system_wq = 0;
+
+void work_init(struct work* w, void (*func)(void*), void* arg) {
+    w->next = 0;
+    w->func = func;
+    w->arg = arg;
+    w->state = 0;
+}
+
+// Returns 0 if the work was already waiting to run
+int queue_work(struct workqueue* wq, struct work* w) {
+    unsigned long flags = irq_save();
+    struct wq_cpu* c = &wq->cpu[cpu_id()];
+
+    if (w->state & WORK_PENDING) {
+        irq_restore(flags);
+        return 0;
+    }
+    w->state |= WORK_PENDING;
+    w->next = 0;
+    if (c->tail) c->tail->next = w;
+    else c->head = w;
+    c->tail = w;
+    c->pending++;
+    wake_up(&wq->more_work);
+    irq_restore(flags);
+    return 1;
+}
+
+// Take work off the queue before it starts. Returns 0 if it was not
+// pending; it may be running, which flush_work() waits out.
+int cancel_work(struct workqueue* wq, struct work* w) {
+    unsigned long flags = irq_save();
+    struct wq_cpu* c = &wq->cpu[cpu_id()];
+    struct work* prev = 0;
+
+    if (!(w->state & WORK_PENDING)) {
+        irq_restore(flags);
+        return 0;
+    }
+    for (struct work* it = c->head; it; prev = it, it = it->next) {
+        if (it != w) continue;
+        if (prev) prev->next = w->next;
+        else c->head = w->next;
+        if (c->tail == w) c->tail = prev;
+        break;
+    }
+    w->state &= ~WORK_PENDING;
+    c->pending--;
+    wq->cancelled++;
+    wake_up_all(&wq->done);
+    irq_restore(flags);
+    return 1;
+}
+
+static int work_running(struct workqueue* wq, struct work* w) {
+    for (uint32_t i = 0; i < wq->nr_workers; i++) {
+        if (wq->running[i] == w) return 1;
+    }
+    return 0;
+}
+
+void flush_work(struct workqueue* wq, struct work* w) {
+    wait_event(&wq->done, !(w->state & WORK_PENDING) && !work_running(wq, w));
+}
+
+// Waits until the queue is empty and nothing is running, including work
+// queued while waiting
+void flush_workqueue(struct workqueue* wq) {
+    struct wq_cpu* c = &wq->cpu[cpu_id()];
+
+    wait_event(&wq->done, !c->pending && !c->active);
+}
+
+static void worker_loop(void* arg) {
+    struct workqueue* wq = arg;
+    struct wq_cpu* c = &wq->cpu[cpu_id()];
+    uint32_t self = 0;
+
+    while (wq->workers[self] != current_thread) self++;
+
+    while (1) {
+        unsigned long flags = irq_save();
+        while (!c->head) wait_queue_sleep(&wq->more_work);
+        struct work* w = c->head;
+        c->head = w->next;
+        if (!c->head) c->tail = 0;
+        c->pending--;
+        c->active++;
+        // Cleared before the call, so the function may queue itself again.
+        // Afterwards w is not touched: the function may have freed it.
+        w->state &= ~WORK_PENDING;
+        wq->running[self] = w;
+        irq_restore(flags);
+
+        w->func(w->arg);
+
+        flags = irq_save();
+        wq->running[self] = 0;
+        c->active--;
+        wq->completed++;
+        wake_up_all(&wq->done);
+        irq_restore(flags);
+        thread_yield();
+    }
+}
+
+__cold struct workqueue* workqueue_create(const char* name, uint32_t max_active) {
+    struct workqueue* wq;
+
+    if (wq_count == WQ_MAX) return 0;
+    if (max_active < 1) max_active = 1;
+    if (max_active > WQ_MAX_ACTIVE) max_active = WQ_MAX_ACTIVE;
+
+    wq = &wq_pool[wq_count++];
+    wq->name = name;
+    wq->max_active = max_active;
+    for (uint32_t i = 0; i < max_active; i++) {
+        struct thread* t = thread_create(name, worker_loop, wq);
+        if (t) wq->workers[wq->nr_workers++] = t;
+    }
+    return wq;
+}
+
+__cold void workqueue_init(void) {
+    system_wq = workqueue_create("kworker", 2);
+}
+
+void workqueue_report(void) {
+    terminal_writestring("name        workers  pending  active  completed  cancelled\n");
+    for (uint32_t i = 0; i < wq_count; i++) {
+        struct workqueue* wq = &wq_pool[i];
+        uint32_t pending = 0, active = 0;
+
+        for (int cpu = 0; cpu < NR_CPUS; cpu++) {
+            pending += wq->cpu[cpu].pending;
+            active += wq->cpu[cpu].active;
+        }
+        terminal_writestring(wq->name);
+        for (int pad = str_len(wq->name); pad < 12; pad++) terminal_putchar(' ');
+        terminal_writedec(wq->nr_workers);
+        terminal_writestring("/");
+        terminal_writedec(wq->max_active);
+        terminal_writestring("      ");
+        terminal_writedec(pending);
+        terminal_writestring("        ");
+        terminal_writedec(active);
+        terminal_writestring("       ");
+        terminal_writedec(wq->completed);
+        terminal_writestring("          ");
+        terminal_writedec(wq->cancelled);
+        terminal_putchar('\n');
+    }
+}